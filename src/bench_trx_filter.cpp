@@ -0,0 +1,80 @@
+// copyright defined in LICENSE.txt
+
+// Compares compiled_trx_filter with checking --trx-filter rules in order.
+//
+//   bench-trx-filter [rules] [actions]
+
+#include "state_history.hpp"
+#include <algorithm>
+#include <iostream>
+#include <random>
+
+using namespace eosio::ship_protocol;
+using state_history::compiled_trx_filter;
+using state_history::trx_filter;
+
+inline eosio::name make_name(uint64_t v) { return eosio::name{v}; }
+
+int main(int argc, char** argv) {
+    uint32_t num_rules   = argc > 1 ? std::stoul(argv[1]) : 300;
+    uint32_t num_actions = argc > 2 ? std::stoul(argv[2]) : 1'000'000;
+    uint32_t num_names   = num_rules * 2 + 1;
+
+    // Roughly what a large config looks like: mostly receivers, some contract actions and action names, and
+    // a final catch-all. Half of the names actions use don't appear in any rule.
+    std::mt19937_64         rng{1234};
+    std::vector<trx_filter> rules;
+    for (uint32_t i = 0; i < num_rules; ++i) {
+        trx_filter rule;
+        auto       key = make_name(i * 2 + 1);
+        rule.include   = i % 7 != 0;
+        switch (i % 10) {
+        case 0: rule.act_name = key; break;
+        case 1:
+        case 2:
+            rule.act_account = key;
+            rule.act_name    = make_name(rng() % num_names + 1);
+            break;
+        case 3: rule.status = transaction_status::executed; [[fallthrough]];
+        default: rule.receiver = key;
+        }
+        rules.push_back(rule);
+    }
+    if (!rules.empty())
+        rules.back() = trx_filter{};
+
+    transaction_trace_v0 ttrace{};
+    ttrace.status = transaction_status::executed;
+
+    std::vector<action_trace> actions;
+    actions.reserve(num_actions);
+    for (uint32_t i = 0; i < num_actions; ++i) {
+        action_trace_v0 atrace{};
+        atrace.receiver    = make_name(rng() % num_names + 1);
+        atrace.act.account = rng() % 2 ? atrace.receiver : make_name(rng() % num_names + 1);
+        atrace.act.name    = make_name(rng() % num_names + 1);
+        actions.push_back(atrace);
+    }
+
+    auto time = [&](auto& filters, std::vector<bool>& results) {
+        results.reserve(actions.size());
+        auto start = std::chrono::steady_clock::now();
+        for (auto& atrace : actions)
+            results.push_back(state_history::filter(filters, ttrace, atrace));
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / actions.size();
+    };
+
+    compiled_trx_filter compiled{rules};
+    std::vector<bool>   linear_results, compiled_results;
+    double              linear_ns   = time(rules, linear_results);
+    double              compiled_ns = time(compiled, compiled_results);
+    if (linear_results != compiled_results) {
+        std::cerr << "compiled_trx_filter and the linear scan disagree\n";
+        return 1;
+    }
+
+    auto included = std::count(linear_results.begin(), linear_results.end(), true);
+    std::cout << num_rules << " rules, " << num_actions << " actions, " << included << " included\n"
+              << "linear:   " << linear_ns << " ns/action\n"
+              << "compiled: " << compiled_ns << " ns/action (" << linear_ns / compiled_ns << "x)\n";
+}
@@ -5,6 +5,10 @@
 const fs = require('fs');
 const schema = 'chain';
 
+// `node create-init-sql.js compact > init-compact.sql` generates the functions for a schema created with
+// `fill-pg --fpg-compact`, which stores names as bigint and checksums as bytea
+const compact = process.argv[2] === 'compact';
+
 const type_map = {
     'bool': 'bool',
     'varuint32': 'bigint',
@@ -59,6 +63,19 @@ const empty_value_map = {
     "transaction_status": "''",
 };
 
+if (compact) {
+    type_map.name = 'bigint';
+    type_map.checksum256 = 'bytea';
+    empty_value_map.name = "'-9223372036854775808'";
+}
+
+// A compact name's low 4 bits hold its 13th character
+function compact_expression(expression) {
+    if (!compact)
+        return expression;
+    return expression.replace(/^substring\((.*) for 12\)$/, '($1 & -16)');
+}
+
 const header = ``;
 let indexes = '';
 let functions = '';
@@ -92,6 +109,24 @@ function generate_index({ table, index, sort_keys, history_keys }) {
             ${sort_keys.map(x => sort_key_expr(x, '', false)).concat(history_keys.map(x => `"${x.name + (x.desc ? '" desc' : '"')}`)).join(',\n            ')}
         )`;
     indexes += ';\n';
+    if (history_keys.length)
+        generate_checkpoint_index({ table, index, sort_keys });
+}
+
+// fill-pg --fpg-checkpoint creates <table>_checkpoint; snapshot queries read it in sort key order
+function generate_checkpoint_index({ table, index, sort_keys }) {
+    indexes += `
+        do $$
+            begin
+                if to_regclass('${schema}.${table}_checkpoint') is not null then
+                    create index if not exists ${index.replace(/_idx$/, '')}_cp on ${schema}.${table}_checkpoint(
+                        "checkpoint_block",
+                        ${sort_keys.map(x => sort_key_expr(x, '', false)).join(',\n                        ')}
+                    );
+                end if;
+            end
+        $$;
+`;
 }
 
 // todo: This likely needs reoptimization.
@@ -188,6 +223,78 @@ function generate_state({ table, index, has_block_snapshot, keys, sort_keys, his
         ${indent}            end if;
     `;
 
+    // Snapshots at or after a checkpoint of the table start from it: the result merges the checkpoint's rows with each
+    // key's newest history row after it, so it doesn't walk keys which weren't present at the checkpoint. Each branch
+    // has at most one row per key, so the first max_results of each are enough. Unlike key_search, this skips keys
+    // deleted at or before the checkpoint and keys with no row at or before the snapshot.
+    const checkpoint_search = indent => `
+        ${indent}if to_regclass('${schema}.state_checkpoint') is not null then
+        ${indent}    select
+        ${indent}        max(state_checkpoint.block_num)
+        ${indent}    into
+        ${indent}        from_checkpoint
+        ${indent}    from
+        ${indent}        ${schema}.state_checkpoint
+        ${indent}    where
+        ${indent}        state_checkpoint.table_name = '${table}'
+        ${indent}        and state_checkpoint.block_num <= snapshot_block_num;
+        ${indent}end if;
+        ${indent}if from_checkpoint is not null then
+        ${indent}    for block_search in
+        ${indent}        select
+        ${indent}            distinct on(${sort_keys_tuple('versions."', '"', ', ')})
+        ${indent}            versions.*
+        ${indent}        from (
+        ${indent}            (select
+        ${indent}                ${ordered_fields.map(f => `checkpoint."${f.name}"`).join(',\n                        ' + indent)}
+        ${indent}            from
+        ${indent}                ${schema}.${table}_checkpoint as checkpoint
+        ${indent}            where
+        ${indent}                checkpoint.checkpoint_block = from_checkpoint
+        ${indent}                and (${sort_keys_tuple('checkpoint."', '"', ', ')}) >= (${sort_keys_tuple('"first_', '"', ', ')})
+        ${indent}                and (${sort_keys_tuple('checkpoint."', '"', ', ')}) <= (${sort_keys_tuple('"last_', '"', ', ')})
+        ${indent}            order by
+        ${indent}                ${sort_keys_tuple('checkpoint."', '"', ',\n                        ' + indent)}
+        ${indent}            limit max_results)
+        ${indent}            union all
+        ${indent}            (select
+        ${indent}                distinct on(${sort_keys_tuple(`${table}."`, '"', ', ')})
+        ${indent}                ${ordered_fields.map(f => `${table}."${f.name}"`).join(',\n                        ' + indent)}
+        ${indent}            from
+        ${indent}                ${schema}.${table}
+        ${indent}            where
+        ${indent}                ${table}.block_num > from_checkpoint
+        ${indent}                and ${table}.block_num <= snapshot_block_num
+        ${indent}                and (${sort_keys_tuple(`${table}."`, '"', ', ')}) >= (${sort_keys_tuple('"first_', '"', ', ')})
+        ${indent}                and (${sort_keys_tuple(`${table}."`, '"', ', ')}) <= (${sort_keys_tuple('"last_', '"', ', ')})
+        ${indent}            order by
+        ${indent}                ${sort_keys_tuple(`${table}."`, '"', ',\n                        ' + indent)},
+        ${indent}                ${history_keys.map(x => `${table}."${x.name + (x.desc ? '" desc' : '"')}`).join(',\n                        ' + indent)}
+        ${indent}            limit max_results)
+        ${indent}        ) as versions
+        ${indent}        order by
+        ${indent}            ${sort_keys_tuple('versions."', '"', ',\n                    ' + indent)},
+        ${indent}            ${history_keys.map(x => `versions."${x.name + (x.desc ? '" desc' : '"')}`).join(',\n                    ' + indent)}
+        ${indent}    loop
+        ${indent}        if block_search.present then
+        ${indent}            ${join ? joined('>=', indent) : non_joined('>=', indent)}
+        ${indent}        else
+        ${indent}            "block_num" = block_search."block_num";
+        ${indent}            "present" = false;
+        ${indent}            ${keys.map(f => `"${f.name}" = block_search."${f.name}";`).join('\n                    ' + indent)}
+        ${indent}            ${data_fields.map(f => `"${f.name}" = ${empty_value_map[f.type] + '::' + type_map[f.type]};`).join('\n                    ' + indent)}
+        ${indent}            ${fields_from_join.map(f => `"${f.join_new_name}" = ${empty_value_map[f.type] + '::' + type_map[f.type]};`).join('\n                    ' + indent)}
+        ${indent}            return next;
+        ${indent}        end if;
+        ${indent}        num_results = num_results + 1;
+        ${indent}        if num_results >= max_results then
+        ${indent}            return;
+        ${indent}        end if;
+        ${indent}    end loop;
+        ${indent}    return;
+        ${indent}end if;
+    `;
+
     const key_search = (compare, indent) => `
         ${indent}for key_search in
         ${indent}    select
@@ -262,10 +369,12 @@ function generate_state({ table, index, has_block_snapshot, keys, sort_keys, his
                 found_key bool = false;
                 found_block bool = false;
                 found_join_block bool = false;
+                ${has_block_snapshot ? `from_checkpoint bigint;` : ``}
             begin
                 if max_results <= 0 then
                     return;
                 end if;
+                ${has_block_snapshot ? checkpoint_search('        ') : ``}
                 ${key_search('>=', '        ')}
                 loop
                     exit when not found_key or num_results >= max_results;
@@ -336,7 +445,7 @@ for (let query of config.queries) {
             "desc": true
         }] : [],
         ordered_fields: tables[query.table].ordered_fields,
-        join_key_values: (query.join_key_values || []).map(({ name, expression }) => ({ name, expression, type: tables[query.join].fields[name].type })),
+        join_key_values: (query.join_key_values || []).map(({ name, expression }) => ({ name, expression: compact_expression(expression), type: tables[query.join].fields[name].type })),
         fields_from_join: (query.fields_from_join || []).map(({ name, join_new_name }) => ({ name, join_new_name, type: tables[query.join].fields[name].type })),
     };
     fill_types(query, query.keys);
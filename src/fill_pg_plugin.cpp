@@ -5,23 +5,38 @@
 
 #include "fill_pg_plugin.hpp"
 #include "state_history_connection.hpp"
+#include "state_history_metrics.hpp"
 #include "state_history_pg.hpp"
 #include "util.hpp"
 
 #include <eosio/for_each_field.hpp>
 #include <boost/asio/connect.hpp>
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/websocket.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <fc/crypto/sha256.hpp>
 #include <fc/exception/exception.hpp>
 
-#include <pqxx/tablewriter>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <libpq-fe.h>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_set>
 
 using namespace abieos;
 using namespace appbase;
 using namespace eosio::ship_protocol;
 using namespace state_history;
 using namespace state_history::pg;
+using state_history::metrics::filler_metrics;
+using metrics_server = state_history::metrics::server;
 using namespace std::literals;
 
 namespace asio      = boost::asio;
@@ -34,32 +49,627 @@ using boost::system::error_code;
 
 inline std::string to_string(const eosio::checksum256& v) { return abieos::hex(v.value.begin(), v.value.end()); }
 
+// Streams rows into a single table using binary COPY. Each stream has its own connection, transaction and thread, so
+// several tables load in parallel. The session's writer thread hands rows over through a lock-free queue.
 struct table_stream {
-    pqxx::connection  c;
-    pqxx::work        t;
-    pqxx::tablewriter writer;
+    static constexpr size_t flush_size = 1024 * 1024;
+    static constexpr size_t queue_size = 64;
+
+    using row_queue = boost::lockfree::spsc_queue<std::string*, boost::lockfree::capacity<queue_size>>;
+
+    PGconn*                 conn = nullptr;
+    std::string             buffer;
+    row_queue               queue;
+    std::mutex              mutex;
+    std::condition_variable cv;
+    bool                    closing = false;
+    bool                    aborted = false;
+    bool                    done    = false;
+    std::exception_ptr      error;
+    std::thread             thread;
+
+    table_stream(const std::string& name) {
+        conn = PQconnectdb("");
+        if (PQstatus(conn) != CONNECTION_OK) {
+            std::string error = PQerrorMessage(conn);
+            PQfinish(conn);
+            throw std::runtime_error("table_stream: " + error);
+        }
+        try {
+            exec("begin", PGRES_COMMAND_OK);
+            exec("copy " + name + " from stdin (format binary)", PGRES_COPY_IN);
+        } catch (...) {
+            PQfinish(conn);
+            throw;
+        }
+        buffer = copy_header;
+        thread = std::thread([this] { run(); });
+    }
+
+    table_stream(const table_stream&) = delete;
+    table_stream& operator=(const table_stream&) = delete;
+
+    ~table_stream() {
+        if (thread.joinable()) {
+            {
+                std::lock_guard lock(mutex);
+                closing = true;
+                aborted = true;
+            }
+            cv.notify_all();
+            thread.join();
+        }
+        std::string* rows;
+        while (queue.pop(rows))
+            delete rows;
+        PQfinish(conn);
+    }
+
+    void exec(const std::string& query, ExecStatusType expected) {
+        auto* result = PQexec(conn, query.c_str());
+        auto  status = PQresultStatus(result);
+        PQclear(result);
+        if (status != expected)
+            throw std::runtime_error(query + ": " + PQerrorMessage(conn));
+    }
+
+    // rows: binary COPY rows, including their field counts. Blocks while the queue is full.
+    void write_rows(std::string rows) {
+        auto* p = new std::string(std::move(rows));
+        while (!queue.push(p)) {
+            std::unique_lock lock(mutex);
+            cv.wait(lock, [&] { return done || queue.write_available(); });
+            if (done) {
+                delete p;
+                rethrow();
+                throw std::runtime_error("table_stream: closed");
+            }
+        }
+        { std::lock_guard lock(mutex); }
+        cv.notify_all();
+    }
+
+    // Asks the thread to send the remaining rows and end the COPY
+    void finish() {
+        {
+            std::lock_guard lock(mutex);
+            closing = true;
+        }
+        cv.notify_all();
+    }
+
+    // Waits for the thread to end the COPY
+    void complete() {
+        finish();
+        thread.join();
+        rethrow();
+    }
+
+    void commit() { exec("commit", PGRES_COMMAND_OK); }
+
+    void rethrow() {
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    void run() {
+        try {
+            while (true) {
+                std::string* rows;
+                if (queue.pop(rows)) {
+                    std::unique_ptr<std::string> owner(rows);
+                    { std::lock_guard lock(mutex); }
+                    cv.notify_all();
+                    buffer += *rows;
+                    if (buffer.size() >= flush_size)
+                        flush();
+                    continue;
+                }
+                std::unique_lock lock(mutex);
+                if (aborted)
+                    break;
+                if (closing && !queue.read_available())
+                    break;
+                cv.wait(lock, [&] { return closing || queue.read_available(); });
+            }
+            if (aborted) {
+                PQputCopyEnd(conn, "aborted");
+            } else {
+                buffer += copy_trailer;
+                flush();
+                if (PQputCopyEnd(conn, nullptr) != 1)
+                    throw std::runtime_error("PQputCopyEnd: "s + PQerrorMessage(conn));
+            }
+            std::string message;
+            while (auto* result = PQgetResult(conn)) {
+                if (PQresultStatus(result) != PGRES_COMMAND_OK && message.empty())
+                    message = PQresultErrorMessage(result);
+                PQclear(result);
+            }
+            if (!aborted && !message.empty())
+                throw std::runtime_error("copy: " + message);
+        } catch (...) { error = std::current_exception(); }
+        {
+            std::lock_guard lock(mutex);
+            done = true;
+        }
+        cv.notify_all();
+    }
+
+    void flush() {
+        if (buffer.empty())
+            return;
+        if (PQputCopyData(conn, buffer.data(), buffer.size()) != 1)
+            throw std::runtime_error("PQputCopyData: "s + PQerrorMessage(conn));
+        buffer.clear();
+    }
+};
+
+// A secondary index which fill-pg builds in the background. schema and name are unquoted.
+struct index_query {
+    std::string schema       = {};
+    std::string name         = {};
+    bool        concurrently = false;
+    std::string query        = {};
+};
+
+// postgresql truncates longer identifiers
+static constexpr size_t max_identifier_length = 63;
+
+// A cancelled concurrent build (e.g. at shutdown) leaves an invalid index behind, which "if not exists" would then
+// skip. This drops an invalid index of the same name before building.
+inline void build_index(pqxx::nontransaction& t, const index_query& index) {
+    auto name    = index.name.substr(0, max_identifier_length);
+    auto invalid = t.exec(
+        "select 1 from pg_index join pg_class on pg_class.oid = pg_index.indexrelid join pg_namespace on "
+        "pg_namespace.oid = pg_class.relnamespace where not pg_index.indisvalid and pg_namespace.nspname = " +
+        t.quote(index.schema) + " and pg_class.relname = " + t.quote(name));
+    if (!invalid.empty()) {
+        ilog("drop invalid index ${i}", ("i", name));
+        t.exec("drop index "s + (index.concurrently ? "concurrently " : "") + t.quote_name(index.schema) + "." + t.quote_name(name));
+    }
+    t.exec(index.query);
+}
+
+// History tables which trim_history empties below the trim point, instead of keeping each key's newest row
+static const char* const wholesale_trim_tables[] = {
+    "received_block",
+    "action_trace_authorization",
+    "action_trace_auth_sequence",
+    "action_trace_ram_delta",
+    "action_trace",
+    "action_trace_v1",
+    "transaction_trace",
+    "block_info",
+};
+
+// Trims history on its own connection and thread, so trimming doesn't hold up the writer. Each chunk of at most
+// chunk_blocks blocks is one transaction, which also records the progress in fill_status.first. In partitioned
+// schemas, the partitions of wholesale_trim_tables which end at or before the chunk's end are dropped instead;
+// trim_history only deletes from the partition the chunk ends in.
+struct history_trimmer {
+    std::string              schema;
+    std::vector<index_query> indexes;
+    std::vector<std::string> setup;
+    uint32_t                 chunk_blocks;
+    uint32_t                 partition_size;
+    std::atomic<uint32_t>&   first;
+    pqxx::connection         conn;
+    std::mutex               mutex;
+    std::condition_variable  cv;
+    uint32_t                 target   = 0;
+    bool                     stopping = false;
+    std::exception_ptr       error;
+    std::thread              thread;
+
+    // indexes, setup: indexes to build and queries to run before the first trim. partition_size: 0 if the schema isn't
+    // partitioned. first: the first block which hasn't been trimmed; shared with the writer, which lowers it on forks.
+    history_trimmer(
+        std::string schema, std::vector<index_query> indexes, std::vector<std::string> setup, uint32_t chunk_blocks,
+        uint32_t partition_size, std::atomic<uint32_t>& first)
+        : schema(std::move(schema))
+        , indexes(std::move(indexes))
+        , setup(std::move(setup))
+        , chunk_blocks(std::max(chunk_blocks, 1u))
+        , partition_size(partition_size)
+        , first(first) {
+        thread = std::thread([this] { run(); });
+    }
+
+    history_trimmer(const history_trimmer&) = delete;
+    history_trimmer& operator=(const history_trimmer&) = delete;
+
+    ~history_trimmer() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        thread.join();
+    }
+
+    // Trims blocks before end. Doesn't wait.
+    void request(uint32_t end) {
+        {
+            std::lock_guard lock(mutex);
+            if (error)
+                std::rethrow_exception(error);
+            if (end <= target)
+                return;
+            target = end;
+        }
+        cv.notify_all();
+    }
+
+    void run() {
+        try {
+            if (!indexes.empty() || !setup.empty()) {
+                ilog("create_trim");
+                pqxx::nontransaction t(conn);
+                for (auto& index : indexes)
+                    build_index(t, index);
+                for (auto& query : setup)
+                    t.exec(query);
+            }
+            while (true) {
+                uint32_t end;
+                {
+                    std::unique_lock lock(mutex);
+                    cv.wait(lock, [&] { return stopping || first < target; });
+                    if (stopping)
+                        return;
+                    end = target;
+                }
+                uint32_t begin = first;
+                end            = std::min(end, begin + chunk_blocks);
+                if (partition_size)
+                    for (uint64_t b = begin - begin % partition_size; b + partition_size <= end; b += partition_size)
+                        drop_partitions(b);
+                pqxx::work t(conn);
+                t.exec(
+                    "select * from " + schema + ".trim_history(" + std::to_string(begin) + ", " + std::to_string(end) + ")");
+                t.exec("update " + schema + ".fill_status set first=" + std::to_string(end));
+                t.commit();
+                if (first.compare_exchange_strong(begin, end))
+                    ilog("trim  ${b} - ${e}", ("b", begin)("e", end));
+            }
+        } catch (const std::exception& e) {
+            elog("trim: ${e}", ("e", e.what()));
+            std::lock_guard lock(mutex);
+            error = std::current_exception();
+        } catch (...) {
+            std::lock_guard lock(mutex);
+            error = std::current_exception();
+        }
+    }
+
+    // Dropping a partition locks its parent table. Each table is its own transaction, so the trimmer never holds one
+    // parent while it waits for the writer to release another.
+    void drop_partitions(uint64_t b) {
+        ilog("drop partitions ${b} - ${e}", ("b", b)("e", b + partition_size));
+        for (auto* table : wholesale_trim_tables) {
+            pqxx::work t(conn);
+            t.exec("drop table if exists " + schema + "." + t.quote_name(table + ("_" + std::to_string(b))));
+            t.commit();
+        }
+    }
+};
 
-    table_stream(const std::string& name)
-        : t(c)
-        , writer(t, name) {}
+// A delta table which gets state checkpoints: its name, its quoted key columns, and its columns
+struct checkpoint_table {
+    std::string name    = {};
+    std::string keys    = {};
+    std::string columns = {};
 };
 
+// Builds state checkpoints on its own connection and thread. The checkpoint of a delta table at block c is in
+// <table>_checkpoint with checkpoint_block = c; it holds each key's newest row at c, if that row is present.
+// Checkpoints are built every interval blocks, each from the one before it plus the history rows in between, so a
+// checkpoint costs the table's state plus the interval's changes. Each is one transaction, which also records it in
+// state_checkpoint.
+struct state_checkpointer {
+    std::string                   schema;
+    std::vector<checkpoint_table> tables;
+    uint32_t                      interval;
+    pqxx::connection              conn;
+    std::mutex                    mutex;
+    std::condition_variable       cv;
+    uint32_t                      target   = 0;
+    std::atomic<bool>             stopping = false;
+    std::exception_ptr            error;
+    std::thread                   thread;
+
+    state_checkpointer(std::string schema, std::vector<checkpoint_table> tables, uint32_t interval)
+        : schema(std::move(schema))
+        , tables(std::move(tables))
+        , interval(std::max(interval, 1u)) {
+        thread = std::thread([this] { run(); });
+    }
+
+    state_checkpointer(const state_checkpointer&) = delete;
+    state_checkpointer& operator=(const state_checkpointer&) = delete;
+
+    // Cancels a checkpoint which hasn't finished; it's rebuilt after a restart
+    ~state_checkpointer() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        conn.cancel_query();
+        thread.join();
+    }
+
+    // Builds the checkpoints at or before end. Doesn't wait.
+    void request(uint32_t end) {
+        {
+            std::lock_guard lock(mutex);
+            if (error)
+                std::rethrow_exception(error);
+            if (end <= target)
+                return;
+            target = end;
+        }
+        cv.notify_all();
+    }
+
+    void run() {
+        try {
+            std::vector<uint32_t> last(tables.size());
+            {
+                pqxx::work t(conn);
+                t.exec(
+                    "create table if not exists " + schema +
+                    R"(.state_checkpoint ("table_name" varchar(64), "block_num" bigint, primary key("table_name", "block_num")))");
+                for (size_t i = 0; i < tables.size(); ++i) {
+                    auto& table = tables[i];
+                    t.exec(
+                        "create table if not exists " + schema + "." + t.quote_name(table.name + "_checkpoint") +
+                        " (checkpoint_block bigint, like " + schema + "." + t.quote_name(table.name) + ", primary key(checkpoint_block" +
+                        (table.keys.empty() ? "" : ", " + table.keys) + "))");
+                    auto r = t.exec(
+                        "select coalesce(max(block_num), 0) from " + schema + ".state_checkpoint where table_name=" + t.quote(table.name));
+                    last[i] = r[0][0].as<uint32_t>();
+                }
+                t.commit();
+            }
+            while (true) {
+                uint32_t end;
+                {
+                    std::unique_lock lock(mutex);
+                    cv.wait(lock, [&] { return stopping || *std::min_element(last.begin(), last.end()) + interval <= target; });
+                    if (stopping)
+                        return;
+                    end = target;
+                }
+                for (size_t i = 0; i < tables.size(); ++i) {
+                    for (; last[i] + interval <= end; last[i] += interval) {
+                        if (stopping)
+                            return;
+                        build(tables[i], last[i], last[i] + interval);
+                    }
+                }
+            }
+        } catch (const std::exception& e) {
+            std::lock_guard lock(mutex);
+            if (!stopping)
+                elog("checkpoint: ${e}", ("e", e.what()));
+            error = std::current_exception();
+        } catch (...) {
+            std::lock_guard lock(mutex);
+            error = std::current_exception();
+        }
+    }
+
+    // Builds table's checkpoint at block from the one at prev
+    void build(const checkpoint_table& table, uint32_t prev, uint32_t block) {
+        pqxx::work  t(conn);
+        auto        history    = schema + "." + t.quote_name(table.name);
+        auto        checkpoint = schema + "." + t.quote_name(table.name + "_checkpoint");
+        std::string latest     = table.keys.empty() ? "select " + table.columns : "select distinct on (" + table.keys + ") " + table.columns;
+        latest += " from (select " + table.columns + " from " + checkpoint + " where checkpoint_block=" + std::to_string(prev);
+        latest += " union all select " + table.columns + " from " + history + " where block_num > " + std::to_string(prev) +
+                  " and block_num <= " + std::to_string(block) + ") as versions order by ";
+        latest += table.keys.empty() ? "block_num desc, present desc limit 1" : table.keys + ", block_num desc, present desc";
+        t.exec(
+            "insert into " + checkpoint + " (checkpoint_block, " + table.columns + ") select " + std::to_string(block) + ", " +
+            table.columns + " from (" + latest + ") as latest where present");
+        t.exec(
+            "insert into " + schema + ".state_checkpoint (table_name, block_num) values (" + t.quote(table.name) + ", " +
+            std::to_string(block) + ")");
+        t.commit();
+        ilog("checkpoint ${t} at block ${b}", ("t", table.name)("b", block));
+    }
+};
+
+// Runs create index queries on several connections at once, each on its own thread
+struct index_builder {
+    std::vector<index_query>                       queries;
+    std::vector<std::unique_ptr<pqxx::connection>> connections;
+    std::vector<std::thread>                       threads;
+    std::atomic<size_t>                            next     = 0;
+    std::atomic<size_t>                            running  = 0;
+    std::atomic<bool>                              stopping = false;
+    std::mutex                                     mutex;
+    std::exception_ptr                             error;
+
+    index_builder(std::vector<index_query> queries, uint32_t num_threads)
+        : queries(std::move(queries)) {
+        auto n = std::max<size_t>(std::min<size_t>(num_threads, this->queries.size()), 1);
+        for (size_t i = 0; i < n; ++i)
+            connections.push_back(std::make_unique<pqxx::connection>());
+        running = n;
+        for (auto& conn : connections)
+            threads.emplace_back([this, &conn = *conn] { run(conn); });
+    }
+
+    index_builder(const index_builder&) = delete;
+    index_builder& operator=(const index_builder&) = delete;
+
+    // Cancels builds which haven't finished
+    ~index_builder() {
+        stopping = true;
+        if (running)
+            for (auto& conn : connections)
+                conn->cancel_query();
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+    bool finished() const { return !running; }
+
+    void rethrow() {
+        std::lock_guard lock(mutex);
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    void run(pqxx::connection& conn) {
+        try {
+            for (size_t i; !stopping && (i = next++) < queries.size();) {
+                ilog("create index ${i} of ${n}", ("i", i + 1)("n", queries.size()));
+                pqxx::nontransaction t(conn);
+                build_index(t, queries[i]);
+            }
+        } catch (...) {
+            std::lock_guard lock(mutex);
+            if (!stopping && !error)
+                error = std::current_exception();
+        }
+        --running;
+    }
+};
+
+// Rows generated for one block. Bulk rows are binary COPY rows grouped by table; other rows are multi-row insert
+// statements grouped by table.
+struct block_rows {
+    std::map<std::string, std::string>              streams    = {};
+    std::map<std::string, std::vector<std::string>> inserts    = {};
+    uint64_t                                        num_rows   = 0;
+    std::set<std::string>                           tables     = {};
+    std::map<std::string, uint64_t>                 table_rows = {};
+    std::map<std::string, std::string>              blobs      = {}; // sha256 => content
+};
+
+// A session forgets which blobs it wrote once it remembers this many; the database skips duplicates anyway
+static constexpr size_t max_written_blobs = 1'000'000;
+
+// A live block's insert statement for a table grows until it reaches this size, then a new one starts
+static constexpr size_t max_insert_size = 1024 * 1024;
+
+// A block moving through the pipeline. The io thread receives it, the decode pool turns bulk blocks into rows, and
+// the writer thread writes blocks in order. frame owns the memory result refers to.
+struct block_job {
+    std::shared_ptr<boost::beast::flat_buffer>               frame             = {};
+    size_t                                                   frame_size        = 0;
+    std::variant<get_blocks_result_v0, get_blocks_result_v1> result            = {};
+    uint32_t                                                 block_num         = 0;
+    eosio::checksum256                                       block_id          = {};
+    std::optional<block_position>                            prev_block        = {};
+    block_position                                           last_irreversible = {};
+    bool                                                     bulk              = false;
+    bool                                                     large_deltas      = false;
+    bool                                                     stop              = false;
+    std::promise<block_rows>                                 decoded           = {};
+    std::future<block_rows>                                  rows              = decoded.get_future();
+};
+
+using job_queue = boost::lockfree::spsc_queue<std::shared_ptr<block_job>>;
+
 struct fpg_session;
 
+struct pg_table;
+
+// A delta table column, or a group of columns, compiled from the abi
+struct pg_field {
+    enum kind_t {
+        scalar,
+        optional_of_struct,
+        variant_of_struct,
+        array_of_struct,
+    };
+
+    kind_t                                 kind               = scalar;
+    const type*                            sql_type           = {};
+    bool                                   optional           = false;
+    bool                                   element_is_variant = false;
+    bool                                   blob               = false;
+    uint32_t                               oid                = 0;
+    uint32_t                               array_oid          = 0;
+    std::string                            type_name          = {};
+    std::unique_ptr<pg_table>              optional_of        = {};
+    std::unique_ptr<pg_table>              array_of           = {};
+    std::vector<std::unique_ptr<pg_table>> variant_of         = {};
+};
+
+// Row layout of a delta table: the ops which convert a row's binary into sql values, and the matching column list
+struct pg_table {
+    std::string             name         = {};
+    const abieos::abi_type* variant_type = {};
+    std::string             columns      = {};
+    uint32_t                num_columns  = 0;
+    std::vector<pg_field>   fields       = {};
+
+    void add_column(pqxx::work& t, const std::string& column) {
+        columns += ", " + t.quote_name(column);
+        ++num_columns;
+    }
+
+    void add_columns(const pg_table& sub) {
+        columns += sub.columns;
+        num_columns += sub.num_columns;
+    }
+};
+
 struct fill_postgresql_config : connection_config {
-    std::string             schema;
-    uint32_t                skip_to       = 0;
-    uint32_t                stop_before   = 0;
-    std::vector<trx_filter> trx_filters   = {};
-    bool                    drop_schema   = false;
-    bool                    create_schema = false;
-    bool                    enable_trim   = false;
+    std::string               schema;
+    uint32_t                  skip_to         = 0;
+    uint32_t                  stop_before     = 0;
+    compiled_trx_filter       trx_filters     = {};
+    std::vector<delta_filter> delta_filters   = {};
+    bool                      drop_schema     = false;
+    bool                      create_schema   = false;
+    bool                      compact_schema  = false;
+    bool                      blob_store      = false;
+    uint32_t                  blob_min_size   = 256;
+    bool                      enable_trim     = false;
+    uint32_t                  decode_threads  = 4;
+    uint32_t                  pipeline_blocks = 64;
+    uint64_t                  pipeline_memory = 1024 * 1024 * 1024;
+    commit_policy             commit          = {};
+    uint32_t                  trim_chunk      = 10000;
+    uint32_t                  partition_size  = 0;
+    bool                      defer_indexes   = false;
+    uint32_t                  index_distance  = 1000;
+    uint32_t                  index_threads   = 4;
+    uint32_t                  backfill        = 0;
+    bool                      current_tables  = false;
+    std::vector<std::string>  checkpoints     = {};
+    uint32_t                  checkpoint_step = 1'000'000;
+    std::string               metrics_address = {};
+};
+
+// Parallel backfill splits the blocks up to irreversible into at least this many blocks per segment
+static constexpr uint32_t min_backfill_segment_blocks = 100'000;
+
+// One block range of a parallel backfill, filled by its own session: blocks [begin, end). head is the last block
+// written, or begin - 1.
+struct backfill_segment {
+    uint32_t segment = 0;
+    uint32_t begin   = 0;
+    uint32_t end     = 0;
+    uint32_t head    = 0;
 };
 
 struct fill_postgresql_plugin_impl : std::enable_shared_from_this<fill_postgresql_plugin_impl> {
-    std::shared_ptr<fill_postgresql_config> config = std::make_shared<fill_postgresql_config>();
-    std::shared_ptr<fpg_session>            session;
-    boost::asio::deadline_timer             timer;
+    std::shared_ptr<fill_postgresql_config>          config = std::make_shared<fill_postgresql_config>();
+    std::shared_ptr<fpg_session>                     session;
+    std::map<uint32_t, std::shared_ptr<fpg_session>> segment_sessions;
+    bool                                             backfill_failed = false;
+    std::shared_ptr<buffer_pool>                     buffers;
+    boost::asio::deadline_timer                      timer;
+    std::shared_ptr<filler_metrics>                  metrics = std::make_shared<filler_metrics>("fill_pg");
+    std::shared_ptr<metrics_server>                  server;
 
     fill_postgresql_plugin_impl()
         : timer(app().get_io_service()) {}
@@ -75,6 +685,9 @@ struct fill_postgresql_plugin_impl : std::enable_shared_from_this<fill_postgresq
     }
 
     void start();
+    void start_backfill(const std::vector<backfill_segment>& segments);
+    void start_segment(const backfill_segment& segment);
+    void segment_closed(const backfill_segment& segment, bool done, bool retry);
 };
 
 struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_session> {
@@ -82,18 +695,52 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
     std::shared_ptr<fill_postgresql_config>              config;
     std::optional<pqxx::connection>                      sql_connection;
     std::shared_ptr<state_history::connection>           connection;
-    bool                                                 created_trim    = false;
     uint32_t                                             head            = 0;
     std::string                                          head_id         = "";
     uint32_t                                             irreversible    = 0;
     std::string                                          irreversible_id = "";
-    uint32_t                                             first           = 0;
+    std::atomic<uint32_t>                                first           = 0;
     uint32_t                                             first_bulk      = 0;
     std::map<std::string, std::unique_ptr<table_stream>> table_streams;
-
-    fpg_session(fill_postgresql_plugin_impl* my)
+    std::map<std::string, uint32_t>                      type_oids;
+    std::map<std::string, pg_table>                      delta_tables;
+    asio::io_context*                                    ioc             = nullptr;
+    uint32_t                                             received_head   = 0;
+    job_queue                                            jobs;
+    std::mutex                                           jobs_mutex;
+    std::condition_variable                              jobs_available;
+    bool                                                 stopping        = false;
+    std::atomic<bool>                                    read_paused     = false;
+    std::atomic<uint64_t>                                pipeline_bytes  = 0;
+    std::atomic<uint32_t>                                pipeline_jobs   = 0; // queued or being written
+    uint32_t                                             unacked         = 0;
+    std::optional<asio::thread_pool>                     decode_pool;
+    std::thread                                          writer;
+    commit_batch                                         batch;
+    std::unique_ptr<history_trimmer>                     trimmer;
+    std::unique_ptr<state_checkpointer>                  checkpointer;
+    uint32_t                                             partition_size   = 0;
+    uint64_t                                             partitioned_from = 0;
+    uint64_t                                             partitioned_to   = 0;
+    std::unique_ptr<index_builder>                       indexes;
+    bool                                                 indexes_built    = false;
+    std::map<uint32_t, std::set<std::string>>            touched_tables;
+    uint32_t                                             tracked_from     = 0;
+    std::optional<backfill_segment>                      segment;
+    std::shared_ptr<filler_metrics>                      metrics;
+    bool                                                 compact          = false;
+    bool                                                 blobs            = false;
+    std::unordered_set<std::string>                      written_blobs;
+
+    fpg_session(fill_postgresql_plugin_impl* my, std::optional<backfill_segment> segment = {})
         : my(my)
-        , config(my->config) {
+        , config(my->config)
+        , jobs(my->config->pipeline_blocks)
+        , batch{my->config->commit}
+        , segment(segment)
+        , metrics(my->metrics)
+        , compact(my->config->compact_schema)
+        , blobs(my->config->blob_store) {
 
         ilog("connect to postgresql");
         sql_connection.emplace();
@@ -108,7 +755,13 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
             config->drop_schema = false;
         }
 
+        this->ioc  = &ioc;
         connection = std::make_shared<state_history::connection>(ioc, *config, shared_from_this());
+        // With --fill-log-dir, the log reader's read-ahead holds buffers too
+        if (!my->buffers)
+            my->buffers = std::make_shared<buffer_pool>(
+                config->pipeline_blocks + 2 + (config->log_dir.empty() ? 0 : 2 * config->log_threads), receive_buffer_size);
+        connection->buffers = my->buffers;
         connection->connect();
     }
 
@@ -121,24 +774,116 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
     }
 
     bool received(get_status_result_v0& status) override {
+        create_current_indexes();
+        if (!segment && config->backfill > 1) {
+            auto segments = plan_backfill(status);
+            if (!segments.empty()) {
+                my->start_backfill(segments);
+                return false;
+            }
+        }
+
         pqxx::work t(*sql_connection);
         load_fill_status(t);
+        load_partition_status(t);
+        load_touched_tables(t);
+        load_current_tables(t);
+        load_type_oids(t);
+        compile_delta_tables(t);
         auto           positions = get_positions(t);
         pqxx::pipeline pipeline(t);
         truncate(t, pipeline, head + 1);
         pipeline.complete();
         t.commit();
+        tracked_from = std::min(tracked_from, head + 1);
 
-        connection->request_blocks(status, std::max(config->skip_to, head + 1), positions);
+        received_head = head;
+        start_pipeline();
+        if (segment)
+            connection->request_blocks(status, head + 1, positions, segment->end);
+        else
+            connection->request_blocks(status, std::max(config->skip_to, head + 1), positions);
         return true;
     }
 
+    // Splits the blocks from head to irreversible into segments which fill in parallel, or resumes the segments of an
+    // interrupted backfill. Complete segments which continue from head are stitched into fill_status first. Returns
+    // the segments to fill; empty when this session should fill blocks itself.
+    std::vector<backfill_segment> plan_backfill(const get_status_result_v0& status) {
+        pqxx::work t(*sql_connection);
+        load_fill_status(t);
+        load_partition_status(t);
+        load_current_tables(t);
+        auto table = t.quote_name(config->schema) + ".backfill_segment";
+        t.exec(
+            "create table if not exists " + table +
+            R"( ("segment" integer, "first_block" bigint, "end_block" bigint, "head" bigint, primary key("segment")))");
+
+        std::vector<backfill_segment> segments;
+        for (auto row : t.exec("select segment, first_block, end_block, head from " + table + " order by segment"))
+            segments.push_back({row[0].as<uint32_t>(), row[1].as<uint32_t>(), row[2].as<uint32_t>(), row[3].as<uint32_t>()});
+
+        size_t num_done = 0;
+        while (num_done < segments.size() && segments[num_done].head + 1 >= segments[num_done].end)
+            ++num_done;
+        if (num_done) {
+            auto r = t.exec(
+                "select block_id from " + t.quote_name(config->schema) +
+                ".received_block where block_num=" + std::to_string(segments[num_done - 1].end - 1));
+            if (r.empty())
+                throw std::runtime_error("backfill segment " + std::to_string(segments[num_done - 1].segment) + " is missing its last block");
+            auto stitched_from = head + 1;
+            if (!first)
+                first = segments.front().begin;
+            head            = segments[num_done - 1].end - 1;
+            head_id         = block_id_from_sql(r[0][0]);
+            irreversible    = head;
+            irreversible_id = head_id;
+            {
+                pqxx::pipeline pipeline(t);
+                write_fill_status(t, pipeline);
+                auto tables = history_tables();
+                update_current(t, pipeline, {tables.begin(), tables.end()}, stitched_from, head);
+                pipeline.complete();
+            }
+            t.exec("delete from " + table + " where segment <= " + std::to_string(segments[num_done - 1].segment));
+            segments.erase(segments.begin(), segments.begin() + num_done);
+            ilog("backfill: stitched blocks up to ${h}", ("h", head));
+        }
+
+        if (segments.empty()) {
+            uint32_t begin = std::max(config->skip_to, head + 1);
+            uint32_t end   = status.last_irreversible.block_num + 1;
+            if (config->stop_before)
+                end = std::min(end, config->stop_before);
+            if (end <= begin || end - begin < uint64_t(config->backfill) * min_backfill_segment_blocks) {
+                t.commit();
+                return {};
+            }
+            uint32_t size = (end - begin + config->backfill - 1) / config->backfill;
+            for (uint32_t i = 0; i < config->backfill; ++i) {
+                backfill_segment seg{i, begin + i * size, std::min(begin + (i + 1) * size, end), begin + i * size - 1};
+                segments.push_back(seg);
+                t.exec(
+                    "insert into " + table + " values (" + std::to_string(seg.segment) + ", " + std::to_string(seg.begin) + ", " +
+                    std::to_string(seg.end) + ", " + std::to_string(seg.head) + ")");
+            }
+            ilog("backfill ${b} - ${e} in ${n} segments", ("b", begin)("e", end - 1)("n", config->backfill));
+        }
+        t.commit();
+
+        // Segments don't create partitions; that would race
+        create_partitions(segments.front().begin);
+        create_partitions(segments.back().end - 1);
+        return segments;
+    }
+
     template <typename T>
     void add_table_field(pqxx::work& t, std::string& fields, const std::string& field_name) {
         if constexpr (is_known_type(type_for<T>)) {
             if (field_name.length() > 64)
                 throw std::runtime_error("field name '" + field_name + "' exceeds postgres column name length limit");
-            std::string type_name = type_for<T>.name;
+            std::string type_name = sql_type<T>().name;
             if (type_name == "transaction_status_type")
                 type_name = t.quote_name(config->schema) + "." + type_name;
             fields += ", "s + t.quote_name(field_name) + " " + type_name;
@@ -172,10 +917,14 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
         if (suffix_fields)
             fields += ","s + suffix_fields;
         std::string query =
-            "create table " + t.quote_name(config->schema) + "." + t.quote_name(name) + "(" + fields + ", primary key (" + pk + "))";
+            "create table " + t.quote_name(config->schema) + "." + t.quote_name(name) + "(" + fields + ", primary key (" + pk + "))" +
+            partition_clause();
         t.exec(query);
     }
 
+    // History tables are range-partitioned on block_num when --fpg-partition-size is set
+    std::string partition_clause() const { return config->partition_size ? " partition by range (block_num)" : ""; }
+
     void fill_field(pqxx::work& t, const std::string& base_name, std::string& fields, const eosio::abi_field& field) {
         if (field.type->as_struct()) {
             for (auto& f : field.type->as_struct()->fields)
@@ -214,8 +963,9 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
             auto abi_type = field.type->name;
             if (abi_type.size() >= 1 && abi_type.back() == '?')
                 abi_type.resize(abi_type.size() - 1);
-            auto it = abi_type_to_sql_type.find(abi_type);
-            if (it == abi_type_to_sql_type.end())
+            auto& types = abi_type_to_sql_type_for(compact);
+            auto  it    = types.find(abi_type);
+            if (it == types.end())
                 throw std::runtime_error("don't know sql type for abi type: " + abi_type);
             std::string type = it->second.name;
             if (type == "transaction_status_type")
@@ -225,29 +975,40 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
     }; // fill_field
 
     void create_tables() {
-        pqxx::work t(*sql_connection);
+        pqxx::work  t(*sql_connection);
+        std::string id   = sql_type<eosio::checksum256>().name;
+        std::string name = sql_type<eosio::name>().name;
 
         ilog("create schema ${s}", ("s", t.quote_name(config->schema)));
         t.exec("create schema " + t.quote_name(config->schema));
+        t.exec("create table " + t.quote_name(config->schema) + R"(.schema_profile ("profile" varchar(64)))");
+        t.exec("create unique index on " + t.quote_name(config->schema) + R"(.schema_profile ((true)))");
+        t.exec("insert into " + t.quote_name(config->schema) + ".schema_profile values (" + quote(compact ? "compact" : "default") + ")");
+        if (compact)
+            for (auto& query : compact_name_function_queries())
+                t.exec(query);
+        if (blobs)
+            t.exec("create table " + t.quote_name(config->schema) + R"(.blob ("hash" bytea, "data" bytea, primary key("hash")))");
         t.exec(
             "create type " + t.quote_name(config->schema) +
             ".transaction_status_type as enum('executed', 'soft_fail', 'hard_fail', 'delayed', 'expired')");
         t.exec(
-            "create table " + t.quote_name(config->schema) +
-            R"(.received_block ("block_num" bigint, "block_id" varchar(64), primary key("block_num")))");
+            "create table " + t.quote_name(config->schema) + R"(.received_block ("block_num" bigint, "block_id" )" + id +
+            R"(, primary key("block_num")))" + partition_clause());
         t.exec(
             "create table " + t.quote_name(config->schema) +
             R"(.fill_status ("head" bigint, "head_id" varchar(64), "irreversible" bigint, "irreversible_id" varchar(64), "first" bigint))");
         t.exec("create unique index on " + t.quote_name(config->schema) + R"(.fill_status ((true)))");
         t.exec("insert into " + t.quote_name(config->schema) + R"(.fill_status values (0, '', 0, '', 0))");
+        create_touched_table(t);
 
         // clang-format off
-        create_table<permission_level>(         t, "action_trace_authorization",  "block_num, transaction_id, action_ordinal, ordinal", "block_num bigint, transaction_id varchar(64), action_ordinal integer, ordinal integer, transaction_status " + t.quote_name(config->schema) + ".transaction_status_type");
-        create_table<account_auth_sequence>(    t, "action_trace_auth_sequence",  "block_num, transaction_id, action_ordinal, ordinal", "block_num bigint, transaction_id varchar(64), action_ordinal integer, ordinal integer, transaction_status " + t.quote_name(config->schema) + ".transaction_status_type");
-        create_table<account_delta>(            t, "action_trace_ram_delta",      "block_num, transaction_id, action_ordinal, ordinal", "block_num bigint, transaction_id varchar(64), action_ordinal integer, ordinal integer, transaction_status " + t.quote_name(config->schema) + ".transaction_status_type");
-        create_table<action_trace_v0>(          t, "action_trace",                "block_num, transaction_id, action_ordinal",          "block_num bigint, transaction_id varchar(64),                                          transaction_status " + t.quote_name(config->schema) + ".transaction_status_type");
-        create_table<action_trace_v1>(          t, "action_trace_v1",             "block_num, transaction_id, action_ordinal",          "block_num bigint, transaction_id varchar(64),                                          transaction_status " + t.quote_name(config->schema) + ".transaction_status_type");
-        create_table<transaction_trace_v0>(     t, "transaction_trace",           "block_num, transaction_ordinal",                     "block_num bigint, transaction_ordinal integer, failed_dtrx_trace varchar(64)", "partial_signatures varchar[], partial_context_free_data bytea[]");
+        create_table<permission_level>(         t, "action_trace_authorization",  "block_num, transaction_id, action_ordinal, ordinal", "block_num bigint, transaction_id " + id + ", action_ordinal integer, ordinal integer, transaction_status " + t.quote_name(config->schema) + ".transaction_status_type");
+        create_table<account_auth_sequence>(    t, "action_trace_auth_sequence",  "block_num, transaction_id, action_ordinal, ordinal", "block_num bigint, transaction_id " + id + ", action_ordinal integer, ordinal integer, transaction_status " + t.quote_name(config->schema) + ".transaction_status_type");
+        create_table<account_delta>(            t, "action_trace_ram_delta",      "block_num, transaction_id, action_ordinal, ordinal", "block_num bigint, transaction_id " + id + ", action_ordinal integer, ordinal integer, transaction_status " + t.quote_name(config->schema) + ".transaction_status_type");
+        create_table<action_trace_v0>(          t, "action_trace",                "block_num, transaction_id, action_ordinal",          "block_num bigint, transaction_id " + id + ",                                          transaction_status " + t.quote_name(config->schema) + ".transaction_status_type");
+        create_table<action_trace_v1>(          t, "action_trace_v1",             "block_num, transaction_id, action_ordinal",          "block_num bigint, transaction_id " + id + ",                                          transaction_status " + t.quote_name(config->schema) + ".transaction_status_type");
+        create_table<transaction_trace_v0>(     t, "transaction_trace",           "block_num, transaction_ordinal",                     "block_num bigint, transaction_ordinal integer, failed_dtrx_trace " + id, "partial_signatures varchar[], partial_context_free_data bytea[]");
         // clang-format on
 
         for (auto& table : connection->abi.tables) {
@@ -266,7 +1027,8 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
             for (auto& key : table.key_names)
                 keys += ", " + t.quote_name(key);
             std::string query =
-                "create table " + t.quote_name(config->schema) + "." + table.type + "(" + fields + ", primary key(" + keys + "))";
+                "create table " + t.quote_name(config->schema) + "." + table.type + "(" + fields + ", primary key(" + keys + "))" +
+                partition_clause();
             t.exec(query);
         }
 
@@ -274,25 +1036,87 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
             "create table " + t.quote_name(config->schema) +
             R"(.block_info(                   
                 "block_num" bigint,
-                "block_id" varchar(64),
+                "block_id" )" + id + R"(,
                 "timestamp" timestamp,
-                "producer" varchar(13),
+                "producer" )" + name + R"(,
                 "confirmed" integer,
-                "previous" varchar(64),
-                "transaction_mroot" varchar(64),
-                "action_mroot" varchar(64),
+                "previous" )" + id + R"(,
+                "transaction_mroot" )" + id + R"(,
+                "action_mroot" )" + id + R"(,
                 "schedule_version" bigint,
                 "new_producers_version" bigint,
-                primary key("block_num")))");
+                primary key("block_num")))" +
+            partition_clause());
+        if (config->partition_size) {
+            t.exec(
+                "create table " + t.quote_name(config->schema) +
+                R"(.partition_status ("size" bigint, "partitioned_from" bigint, "partitioned_to" bigint))");
+            t.exec("create unique index on " + t.quote_name(config->schema) + R"(.partition_status ((true)))");
+            t.exec(
+                "insert into " + t.quote_name(config->schema) + ".partition_status values (" + std::to_string(config->partition_size) +
+                ", 0, 0)");
+        }
 
         t.commit();
     } // create_tables()
 
-    void create_trim() {
-        if (created_trim)
-            return;
-        pqxx::work t(*sql_connection);
-        ilog("create_trim");
+    // Queries which create name_to_bigint and bigint_to_name, which convert between names and the compact profile's
+    // bigints. e.g. select * from chain.action_trace where receiver = chain.name_to_bigint('eosio')
+    std::vector<std::string> compact_name_function_queries() {
+        auto schema = quote_name(config->schema);
+        return {
+            "create function " + schema + R"(.name_to_bigint(s varchar) returns bigint
+            language plpgsql immutable strict
+            as $$
+                declare
+                    chars  constant varchar := '.12345abcdefghijklmnopqrstuvwxyz';
+                    result bigint := 0;
+                    c      bigint;
+                begin
+                    for i in 1 .. least(length(s), 13) loop
+                        c := position(substr(s, i, 1) in chars) - 1;
+                        if c < 0 then
+                            raise exception 'invalid name: %', s;
+                        end if;
+                        if i <= 12 then
+                            result := result | ((c & 31) << (64 - 5 * i));
+                        else
+                            result := result | (c & 15);
+                        end if;
+                    end loop;
+                    return result # (1::bigint << 63);
+                end
+            $$)",
+            "create function " + schema + R"(.bigint_to_name(v bigint) returns varchar
+            language plpgsql immutable strict
+            as $$
+                declare
+                    chars  constant varchar := '.12345abcdefghijklmnopqrstuvwxyz';
+                    n      bigint := v # (1::bigint << 63);
+                    result varchar := '';
+                begin
+                    for i in 1 .. 12 loop
+                        result := result || substr(chars, ((n >> (64 - 5 * i)) & 31)::integer + 1, 1);
+                    end loop;
+                    result := result || substr(chars, (n & 15)::integer + 1, 1);
+                    return rtrim(result, '.');
+                end
+            $$)",
+        };
+    } // compact_name_function_queries
+
+    // on: the table and columns
+    index_query create_index(const std::string& name, const std::string& on) const {
+        // postgresql can't build an index on a partitioned table concurrently
+        return {
+            config->schema, name, !partition_size,
+            "create index "s + (partition_size ? "" : "concurrently ") + "if not exists " + quote_name(name) + " on " + on};
+    }
+
+    // The index trim_history needs on each keyed delta table
+    std::vector<index_query> trim_index_queries() {
+        std::vector<index_query> result;
+        auto                     schema = quote_name(config->schema);
         for (auto& table : connection->abi.tables) {
             if (table.type == "global_property")
                 continue;
@@ -300,59 +1124,71 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
                 continue;
             if (table.key_names.empty())
                 continue;
-            std::string query = "create index if not exists " + table.type;
+            std::string name = table.type;
             for (auto& k : table.key_names)
-                query += "_" + k;
-            query += "_block_present_idx on " + t.quote_name(config->schema) + "." + t.quote_name(table.type) + "(\n";
+                name += "_" + k;
+            name += "_block_present_idx";
+            std::string on = schema + "." + quote_name(table.type) + "(\n";
             for (auto& k : table.key_names)
-                query += "    " + t.quote_name(k) + ",\n";
-            query += "    \"block_num\" desc,\n    \"present\" desc\n)";
-            // std::cout << query << ";\n\n";
-            t.exec(query);
+                on += "    " + quote_name(k) + ",\n";
+            on += "    \"block_num\" desc,\n    \"present\" desc\n)";
+            result.push_back(create_index(name, on));
         }
+        return result;
+    }
 
-        std::string query = R"(
-            drop function if exists )" +
-                            t.quote_name(config->schema) + R"(.trim_history;
-        )";
-        // std::cout << query << "\n";
-        t.exec(query);
+    // Indexes --fpg-defer-indexes builds after catch-up: the action_trace indexes from init.sql and the trim indexes
+    std::vector<index_query> deferred_index_queries() {
+        auto action_trace = quote_name(config->schema) + ".action_trace";
+        std::vector<index_query> result{
+            create_index(
+                "at_range_name_receiver_account_block_trans_action_idx",
+                action_trace + R"(("act_name", "receiver", "act_account", "block_num", "transaction_id", "action_ordinal"))"),
+            create_index("receipt_receiver_idx", action_trace + R"(("receiver", "block_num", "transaction_id", "action_ordinal"))"),
+            create_index("transaction_idx", action_trace + R"(("transaction_id", "block_num", "action_ordinal"))"),
+        };
+        for (auto& query : trim_index_queries())
+            result.push_back(std::move(query));
+        return result;
+    }
 
-        query = R"(
+    // Queries which create the trim_history function. Each table is trimmed with one set-based delete instead of a
+    // delete per key.
+    std::vector<std::string> trim_function_queries() {
+        std::vector<std::string> result;
+        auto                     schema = quote_name(config->schema);
+        result.push_back("drop function if exists " + schema + ".trim_history");
+
+        std::string query = R"(
             create function )" +
-                t.quote_name(config->schema) + R"(.trim_history(
+                            schema + R"(.trim_history(
                 prev_block_num bigint,
                 irrev_block_num bigint
             ) returns void
             as $$
-                declare
-                    key_search record;
                 begin)";
 
-        static const char* const simple_cases[] = {
-            "received_block",
-            "action_trace_authorization",
-            "action_trace_auth_sequence",
-            "action_trace_ram_delta",
-            "action_trace",
-            "action_trace_v1",
-            "transaction_trace",
-            "block_info",
-        };
-
-        for (const char* table : simple_cases) {
+        // In partitioned schemas the trimmer drops the partitions below the one irrev_block_num is in
+        std::string trim_from = "prev_block_num";
+        if (partition_size)
+            trim_from = "greatest(prev_block_num, irrev_block_num - irrev_block_num % " + std::to_string(partition_size) + ")";
+        for (const char* table : wholesale_trim_tables) {
             query += R"(
                     delete from )" +
-                     t.quote_name(config->schema) + "." + t.quote_name(table) + R"(
+                     schema + "." + quote_name(table) + R"(
                     where
-                        block_num >= prev_block_num
+                        block_num >= )" +
+                     trim_from + R"(
                         and block_num < irrev_block_num;
                     )";
         }
 
-        auto add_trim = [&](const std::string& table, const std::string& keys, const std::string& search_keys) {
+        // Deletes the rows each key replaced: rows older than the key's newest row in the range
+        auto add_trim = [&](const std::string& table, const std::string& keys, const std::string& old_keys, const std::string& search_keys) {
             query += R"(
-                    for key_search in
+                    delete from )" +
+                     schema + "." + quote_name(table) + R"( as old_row
+                    using (
                         select
                             distinct on()" +
                      keys + R"()
@@ -360,19 +1196,16 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
                      keys + R"(, block_num
                         from
                             )" +
-                     t.quote_name(config->schema) + "." + t.quote_name(table) + R"(
+                     schema + "." + quote_name(table) + R"(
                         where
                             block_num > prev_block_num and block_num <= irrev_block_num
                         order by )" +
                      keys + R"(, block_num desc, present desc
-                    loop
-                        delete from )" +
-                     t.quote_name(config->schema) + "." + t.quote_name(table) + R"(
-                        where
-                            ()" +
-                     keys + R"() = ()" + search_keys + R"()
-                            and block_num < key_search.block_num;
-                    end loop;
+                    ) as key_search
+                    where
+                        ()" +
+                     old_keys + R"() = ()" + search_keys + R"()
+                        and old_row.block_num < key_search.block_num;
                     )";
         };
 
@@ -383,34 +1216,33 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
                 continue;
             if (table.key_names.empty()) {
                 query += R"(
-                    for key_search in
-                        select
-                            block_num
-                        from
-                            )" +
-                         t.quote_name(config->schema) + "." + t.quote_name(table.type) + R"(
-                        where
-                            block_num > prev_block_num and block_num <= irrev_block_num
-                        order by block_num desc, present desc
-                        limit 1
-                    loop
-                        delete from )" +
-                         t.quote_name(config->schema) + "." + t.quote_name(table.type) + R"(
-                        where
-                            block_num < key_search.block_num;
-                    end loop;
+                    delete from )" +
+                         schema + "." + quote_name(table.type) + R"(
+                    where
+                        block_num < (
+                            select
+                                block_num
+                            from
+                                )" +
+                         schema + "." + quote_name(table.type) + R"(
+                            where
+                                block_num > prev_block_num and block_num <= irrev_block_num
+                            order by block_num desc, present desc
+                            limit 1);
                     )";
             } else {
-                std::string keys, search_keys;
+                std::string keys, old_keys, search_keys;
                 for (auto& k : table.key_names) {
                     if (&k != &table.key_names.front()) {
                         keys += ", ";
+                        old_keys += ", ";
                         search_keys += ", ";
                     }
-                    keys += t.quote_name(k);
-                    search_keys += "key_search." + t.quote_name(k);
+                    keys += quote_name(k);
+                    old_keys += "old_row." + quote_name(k);
+                    search_keys += "key_search." + quote_name(k);
                 }
-                add_trim(table.type, keys, search_keys);
+                add_trim(table.type, keys, old_keys, search_keys);
             };
         }
         query += R"(
@@ -418,13 +1250,13 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
             $$ language plpgsql;
         )";
 
-        // std::cout << query << "\n\n";
-        t.exec(query);
-        t.commit();
-        created_trim = true;
-    } // create_trim
+        result.push_back(query);
+        return result;
+    } // trim_function_queries
 
     void load_fill_status(pqxx::work& t) {
+        compact = is_compact_schema(t, config->schema);
+        blobs   = has_blob_store(t, config->schema);
         auto r =
             t.exec("select head, head_id, irreversible, irreversible_id, first from " + t.quote_name(config->schema) + ".fill_status")[0];
         head            = r[0].as<uint32_t>();
@@ -432,10 +1264,102 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
         irreversible    = r[2].as<uint32_t>();
         irreversible_id = r[3].as<std::string>();
         first           = r[4].as<uint32_t>();
+        if (segment) {
+            auto seg = t.exec(
+                "select head from " + t.quote_name(config->schema) + ".backfill_segment where segment=" + std::to_string(segment->segment));
+            if (seg.empty())
+                throw std::runtime_error("backfill segment " + std::to_string(segment->segment) + " not found");
+            head    = seg[0][0].as<uint32_t>();
+            auto id = t.exec(
+                "select block_id from " + t.quote_name(config->schema) + ".received_block where block_num=" + std::to_string(head));
+            head_id         = id.empty() ? "" : block_id_from_sql(id[0][0]);
+            irreversible    = head;
+            irreversible_id = head_id;
+        }
+    }
+
+    // received_block.block_id as hex, in either profile
+    static std::string block_id_from_sql(const pqxx::field& f) { return *f.c_str() ? to_string(sql_to_checksum256(f.c_str())) : ""; }
+
+    // T's sql type in the schema's profile
+    template <typename T>
+    const type& sql_type() const {
+        return compact ? compact_type_for<T> : type_for<T>;
+    }
+
+    // A checksum256 or name, for sql_values(), in the schema's profile
+    template <typename T>
+    profiled<T> in_profile(const T& v) const {
+        return {v, compact};
+    }
+
+    void load_partition_status(pqxx::work& t) {
+        partition_size = 0;
+        if (t.exec("select to_regclass(" + t.quote(t.quote_name(config->schema) + ".partition_status") + ") is null")[0][0].as<bool>())
+            return;
+        auto r = t.exec("select size, partitioned_from, partitioned_to from " + t.quote_name(config->schema) + ".partition_status")[0];
+        partition_size   = r[0].as<uint32_t>();
+        partitioned_from = r[1].as<uint64_t>();
+        partitioned_to   = r[2].as<uint64_t>();
+    }
+
+    // Creates the partitions needed for block_num, and the next one so they're ready before head reaches them.
+    // Creating a partition locks its parent table, so this closes the streams first.
+    void create_partitions(uint32_t block_num) {
+        if (!partition_size || segment)
+            return;
+        uint64_t begin = block_num - block_num % partition_size;
+        uint64_t end   = begin + 2 * uint64_t(partition_size);
+        if (partitioned_from < partitioned_to && begin >= partitioned_from && end <= partitioned_to)
+            return;
+
+        close_streams();
+        if (partitioned_from == partitioned_to)
+            partitioned_from = partitioned_to = begin;
+        auto tables = history_tables();
+        auto create = [&](pqxx::work& t, uint64_t b) {
+            ilog("create partitions ${b} - ${e}", ("b", b)("e", b + partition_size));
+            for (auto& name : tables)
+                t.exec(
+                    "create table if not exists " + t.quote_name(config->schema) + "." + t.quote_name(name + "_" + std::to_string(b)) +
+                    " partition of " + t.quote_name(config->schema) + "." + t.quote_name(name) + " for values from (" +
+                    std::to_string(b) + ") to (" + std::to_string(b + partition_size) + ")");
+        };
+        pqxx::work t(*sql_connection);
+        for (; partitioned_from > begin; partitioned_from -= partition_size)
+            create(t, partitioned_from - partition_size);
+        for (; partitioned_to < end; partitioned_to += partition_size)
+            create(t, partitioned_to);
+        t.exec(
+            "update " + t.quote_name(config->schema) + ".partition_status set partitioned_from=" + std::to_string(partitioned_from) +
+            ", partitioned_to=" + std::to_string(partitioned_to));
+        t.commit();
+    }
+
+    // Composite and array values in binary COPY carry the oids of their element types
+    void load_type_oids(pqxx::work& t) {
+        type_oids.clear();
+        auto rows = t.exec(
+            "select pg_type.typname, pg_type.oid from pg_type join pg_namespace on pg_namespace.oid = pg_type.typnamespace "
+            "where pg_namespace.nspname = " +
+            t.quote(config->schema));
+        for (auto row : rows)
+            type_oids[row[0].as<std::string>()] = row[1].as<uint32_t>();
     }
 
+    uint32_t get_type_oid(const std::string& name) {
+        auto it = type_oids.find(name);
+        if (it == type_oids.end())
+            throw std::runtime_error("unknown postgresql type " + config->schema + "." + name);
+        return it->second;
+    }
+
+    uint32_t get_type_oid(const type& t) { return t.oid ? t.oid : get_type_oid(t.name); }
+
     std::vector<block_position> get_positions(pqxx::work& t) {
         std::vector<block_position> result;
+        if (segment)
+            return result;
         auto                        rows = t.exec(
             "select block_num, block_id from " + t.quote_name(config->schema) + ".received_block where block_num >= " +
             std::to_string(irreversible) + " and block_num <= " + std::to_string(head) + " order by block_num");
@@ -445,35 +1369,109 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
     }
 
     void write_fill_status(pqxx::work& t, pqxx::pipeline& pipeline) {
+        if (segment) {
+            pipeline.insert(
+                "update " + t.quote_name(config->schema) + ".backfill_segment set head=" + std::to_string(head) +
+                " where segment=" + std::to_string(segment->segment));
+            return;
+        }
         std::string query = "update " + t.quote_name(config->schema) + ".fill_status set head=" + std::to_string(head) +
                             ", head_id=" + quote(head_id) + ", ";
         if (irreversible < head)
             query += "irreversible=" + std::to_string(irreversible) + ", irreversible_id=" + quote(irreversible_id);
         else
             query += "irreversible=" + std::to_string(head) + ", irreversible_id=" + quote(head_id);
-        query += ", first=" + std::to_string(first);
+        query += ", first=" + std::to_string(first.load());
         pipeline.insert(query);
+        prune_touched(t, pipeline);
     }
 
-    void truncate(pqxx::work& t, pqxx::pipeline& pipeline, uint32_t block) {
-        auto trunc = [&](const std::string& name) {
-            pipeline.insert(
-                "delete from " + t.quote_name(config->schema) + "." + t.quote_name(name) + " where block_num >= " + std::to_string(block));
+    // Tables which have a row per block_num; these are partitioned in partitioned schemas
+    std::vector<std::string> history_tables() {
+        std::vector<std::string> result = {
+            "received_block", "action_trace_authorization", "action_trace_auth_sequence", "action_trace_ram_delta",
+            "action_trace",   "action_trace_v1",            "transaction_trace",          "block_info",
         };
-        trunc("received_block");
-        trunc("action_trace_authorization");
-        trunc("action_trace_auth_sequence");
-        trunc("action_trace_ram_delta");
-        trunc("action_trace");
-        trunc("action_trace_v1");
-        trunc("transaction_trace");
-        trunc("block_info");
         for (auto& table : connection->abi.tables) {
             if (table.type == "global_property")
                 continue;
             if (table.type == "chain_config")
                 continue;
-            trunc(table.type);
+            result.push_back(table.type);
+        }
+        return result;
+    }
+
+    void create_touched_table(pqxx::work& t) {
+        t.exec(
+            "create table if not exists " + t.quote_name(config->schema) +
+            R"(.touched_table ("block_num" bigint, "table_name" varchar(64), primary key("block_num", "table_name")))");
+    }
+
+    // touched_table records which tables received rows for blocks a fork could remove. Schemas created before it
+    // existed aren't tracked until the blocks after the current head.
+    void load_touched_tables(pqxx::work& t) {
+        touched_tables.clear();
+        if (segment) {
+            tracked_from = std::numeric_limits<uint32_t>::max();
+            return;
+        }
+        if (t.exec("select to_regclass(" + t.quote(t.quote_name(config->schema) + ".touched_table") + ") is null")[0][0].as<bool>()) {
+            create_touched_table(t);
+            tracked_from = std::numeric_limits<uint32_t>::max();
+            return;
+        }
+        tracked_from = 0;
+        for (auto row : t.exec("select block_num, table_name from " + t.quote_name(config->schema) + ".touched_table"))
+            touched_tables[row[0].as<uint32_t>()].insert(row[1].as<std::string>());
+    }
+
+    void record_touched(pqxx::work& t, pqxx::pipeline& pipeline, uint32_t block_num, const std::set<std::string>& tables) {
+        if (segment)
+            return;
+        auto&       touched = touched_tables[block_num];
+        std::string values;
+        for (auto& name : tables) {
+            if (!touched.insert(name).second)
+                continue;
+            if (!values.empty())
+                values += ", ";
+            values += "(" + std::to_string(block_num) + ", " + quote(name) + ")";
+        }
+        if (!values.empty())
+            pipeline.insert(
+                "insert into " + t.quote_name(config->schema) + ".touched_table (block_num, table_name) values " + values +
+                " on conflict do nothing");
+    }
+
+    // Irreversible blocks can't be removed by a fork
+    void prune_touched(pqxx::work& t, pqxx::pipeline& pipeline) {
+        if (touched_tables.empty() || touched_tables.begin()->first > irreversible)
+            return;
+        touched_tables.erase(touched_tables.begin(), touched_tables.upper_bound(irreversible));
+        pipeline.insert("delete from " + t.quote_name(config->schema) + ".touched_table where block_num <= " + std::to_string(irreversible));
+    }
+
+    // Removes blocks >= block, or the rest of the segment. Only tables recorded in touched_tables are touched, unless
+    // the blocks predate tracking.
+    void truncate(pqxx::work& t, pqxx::pipeline& pipeline, uint32_t block) {
+        std::string range = "block_num >= " + std::to_string(block);
+        if (segment)
+            range += " and block_num < " + std::to_string(segment->end);
+        std::set<std::string> tables = {"received_block"};
+        if (block < tracked_from) {
+            for (auto& name : history_tables())
+                tables.insert(name);
+        } else {
+            for (auto it = touched_tables.lower_bound(block); it != touched_tables.end(); ++it)
+                tables.insert(it->second.begin(), it->second.end());
+        }
+        revert_current(t, pipeline, tables, block);
+        for (auto& name : tables)
+            pipeline.insert("delete from " + t.quote_name(config->schema) + "." + t.quote_name(name) + " where " + range);
+        if (!segment) {
+            touched_tables.erase(touched_tables.lower_bound(block), touched_tables.end());
+            pipeline.insert("delete from " + t.quote_name(config->schema) + ".touched_table where " + range);
         }
 
         auto result = pipeline.retrieve(pipeline.insert(
@@ -483,293 +1481,763 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
             head_id = "";
         } else {
             head    = block - 1;
-            head_id = result.front()[0].as<std::string>();
+            head_id = block_id_from_sql(result.front()[0]);
         }
-        first = std::min(first, head);
+        first = std::min(first.load(), head);
     } // truncate
 
+    // With --fpg-current-tables, each delta table has a <table>_current companion holding the newest row of each key
+    // if that row is present; its block_num is the block which last changed the key. The companions track history up
+    // to fill_status head: they're updated in the transaction which moves head forward, and reverted in the one which
+    // truncates a fork. Schemas which don't have them yet get them built from history. Backfill segments leave them
+    // alone; stitching a segment updates them.
+    void load_current_tables(pqxx::work& t) {
+        if (!config->current_tables || segment)
+            return;
+        for (auto& table : connection->abi.tables) {
+            if (table.type == "global_property")
+                continue;
+            if (table.type == "chain_config")
+                continue;
+            auto current = t.quote_name(config->schema) + "." + t.quote_name(table.type + "_current");
+            if (!t.exec("select to_regclass(" + t.quote(current) + ") is null")[0][0].as<bool>())
+                continue;
+            ilog("create ${t}", ("t", current));
+            std::string keys;
+            for (auto& k : table.key_names)
+                keys += (keys.empty() ? "" : ", ") + t.quote_name(k);
+            t.exec(
+                "create table " + current + " (like " + t.quote_name(config->schema) + "." + t.quote_name(table.type) +
+                (keys.empty() ? "" : ", primary key(" + keys + ")") + ")");
+            for (auto& query : current_queries(table.type, table.key_names, "block_num <= " + std::to_string(head), ""))
+                t.exec(query);
+        }
+    }
+
+    // Maintaining and reverting the _current tables looks up history rows by key, which needs the trim indexes. With
+    // --fpg-defer-indexes they're built before the writer gets near head, which is where forks happen.
+    void create_current_indexes() {
+        if (!config->current_tables || config->defer_indexes || segment)
+            return;
+        {
+            pqxx::work t(*sql_connection);
+            load_partition_status(t);
+            t.commit();
+        }
+        pqxx::nontransaction t(*sql_connection);
+        for (auto& index : trim_index_queries())
+            build_index(t, index);
+    }
+
+    // Queries which update a delta table's _current companion for the history rows matching changed: the keys those
+    // rows changed are removed, then each key's newest row matching source (or changed, if source is empty) is put
+    // back if it's present
+    std::vector<std::string> current_queries(
+        const std::string& name, const std::vector<std::string>& key_names, const std::string& changed, const std::string& source) {
+        auto history = quote_name(config->schema) + "." + quote_name(name);
+        auto current = quote_name(config->schema) + "." + quote_name(name + "_current");
+        if (key_names.empty()) {
+            auto any_changed = "exists (select 1 from " + history + " where " + changed + ")";
+            return {
+                "delete from " + current + " where " + any_changed,
+                "insert into " + current + " select * from (select * from " + history + " where " +
+                    (source.empty() ? changed : source + " and " + any_changed) +
+                    " order by block_num desc, present desc limit 1) as latest where present",
+            };
+        }
+        std::string keys;
+        for (auto& k : key_names)
+            keys += (keys.empty() ? "" : ", ") + quote_name(k);
+        auto changed_keys = "(" + keys + ") in (select " + keys + " from " + history + " where " + changed + ")";
+        return {
+            "delete from " + current + " where " + changed_keys,
+            "insert into " + current + " select * from (select distinct on (" + keys + ") * from " + history + " where " +
+                (source.empty() ? changed : source + " and " + changed_keys) + " order by " + keys +
+                ", block_num desc, present desc) as latest where present",
+        };
+    }
+
+    // Blocks [first_block, last_block] were written to the delta tables in tables
+    void update_current(
+        pqxx::work& t, pqxx::pipeline& pipeline, const std::set<std::string>& tables, uint32_t first_block, uint32_t last_block) {
+        if (!config->current_tables || segment || first_block > last_block)
+            return;
+        for (auto& table : connection->abi.tables) {
+            if (table.type == "global_property" || table.type == "chain_config" || !tables.count(table.type))
+                continue;
+            auto range = "block_num >= " + std::to_string(first_block) + " and block_num <= " + std::to_string(last_block);
+            for (auto& query : current_queries(table.type, table.key_names, range, ""))
+                pipeline.insert(query);
+        }
+    }
+
+    // The rows of blocks >= block in tables are about to be removed; puts back the rows they replaced. Must run
+    // before the history rows are deleted.
+    void revert_current(pqxx::work& t, pqxx::pipeline& pipeline, const std::set<std::string>& tables, uint32_t block) {
+        if (!config->current_tables || segment)
+            return;
+        for (auto& table : connection->abi.tables) {
+            if (table.type == "global_property" || table.type == "chain_config" || !tables.count(table.type))
+                continue;
+            auto queries = current_queries(
+                table.type, table.key_names, "block_num >= " + std::to_string(block), "block_num < " + std::to_string(block));
+            for (auto& query : queries)
+                pipeline.insert(query);
+        }
+    }
+
     bool received(get_blocks_result_v1& result) override {
-       if (!result.this_block)
-           return true;
-       bool bulk         = result.this_block->block_num + 4 < result.last_irreversible.block_num;
-       bool large_deltas = false;
-       auto deltas       = result.deltas.unpack();
-       auto deltas_size  = deltas.size();
-       if (!bulk && deltas_size >= 10 * 1024 * 1024) {
-           ilog("large deltas size: ${s}", ("s", uint64_t(deltas_size)));
-           bulk         = true;
-           large_deltas = true;
-       }
-
-       if (config->stop_before && result.this_block->block_num >= config->stop_before) {
-           close_streams();
-           ilog("block ${b}: stop requested", ("b", result.this_block->block_num));
-           return false;
-       }
-
-       if (result.this_block->block_num <= head) {
-           close_streams();
-           ilog("switch forks at block ${b}", ("b", result.this_block->block_num));
-           bulk = false;
-       }
-
-       if (!bulk || large_deltas || !(result.this_block->block_num % 200))
-           close_streams();
-       if (table_streams.empty())
-           trim();
-       if (!bulk)
-           ilog("block ${b}", ("b", result.this_block->block_num));
-
-       pqxx::work     t(*sql_connection);
-       pqxx::pipeline pipeline(t);
-       if (result.this_block->block_num <= head)
-           truncate(t, pipeline, result.this_block->block_num);
-       if (!head_id.empty() && (!result.prev_block || to_string(result.prev_block->block_id) != head_id))
-           throw std::runtime_error("prev_block does not match");
-       if (result.block)
-           receive_block(result.this_block->block_num, result.this_block->block_id, result.block.value(), bulk, t, pipeline);
-       if (!result.deltas.empty())
-           receive_deltas(result.this_block->block_num, std::move(deltas), bulk, t, pipeline);
-       if (!result.traces.empty())
-           receive_traces(result.this_block->block_num, result.traces.unpack(), bulk, t, pipeline);
-
-       head            = result.this_block->block_num;
-       head_id         = to_string(result.this_block->block_id);
-       irreversible    = result.last_irreversible.block_num;
-       irreversible_id = to_string(result.last_irreversible.block_id);
-       if (!first)
-           first = head;
-       if (!bulk)
-           write_fill_status(t, pipeline);
-       pipeline.insert(
-           "insert into " + t.quote_name(config->schema) + ".received_block (block_num, block_id) values (" +
-           std::to_string(result.this_block->block_num) + ", " + quote(to_string(result.this_block->block_id)) + ")");
-
-       pipeline.complete();
-       while(!pipeline.empty())
-           pipeline.retrieve();
-       t.commit();
-       if (large_deltas)
-           close_streams();
-       return true;
+        if (!result.this_block) {
+            ack_blocks(1);
+            return true;
+        }
+        bool large_deltas = false;
+        if (config->commit.near_head(result.this_block->block_num, result.last_irreversible.block_num)) {
+            auto deltas_size = result.deltas.num_bytes();
+            if (deltas_size >= 10 * 1024 * 1024) {
+                ilog("large deltas size: ${s}", ("s", uint64_t(deltas_size)));
+                large_deltas = true;
+            }
+        }
+        return enqueue_block(result, large_deltas);
     }
 
     bool received(get_blocks_result_v0& result) override {
-        if (!result.this_block)
+        if (!result.this_block) {
+            ack_blocks(1);
             return true;
-        bool bulk         = result.this_block->block_num + 4 < result.last_irreversible.block_num;
+        }
         bool large_deltas = false;
-        if (!bulk && result.deltas && result.deltas->end - result.deltas->pos >= 10 * 1024 * 1024) {
+        if (config->commit.near_head(result.this_block->block_num, result.last_irreversible.block_num) && result.deltas &&
+            result.deltas->end - result.deltas->pos >= 10 * 1024 * 1024) {
             ilog("large deltas size: ${s}", ("s", uint64_t(result.deltas->end - result.deltas->pos)));
-            bulk         = true;
             large_deltas = true;
         }
+        return enqueue_block(result, large_deltas);
+    }
+
+    // Runs on the io thread. Hands the block to the decode pool (bulk) and the writer thread, and stops reading from
+    // the socket while the pipeline is full or holds more than pipeline_memory bytes of messages.
+    template <typename Result>
+    bool enqueue_block(Result& result, bool large_deltas) {
+        auto job               = std::make_shared<block_job>();
+        job->frame             = connection->frame;
+        job->frame_size        = job->frame ? job->frame->size() : 0;
+        job->block_num         = result.this_block->block_num;
+        job->block_id          = result.this_block->block_id;
+        job->prev_block        = result.prev_block;
+        job->last_irreversible = result.last_irreversible;
+        job->bulk              = large_deltas || !config->commit.near_head(job->block_num, result.last_irreversible.block_num);
+        job->large_deltas      = large_deltas;
+        metrics->receive_wait.observe(connection->read_wait);
+        metrics->chain_head.set(result.head.block_num);
+        metrics->chain_irreversible.set(result.last_irreversible.block_num);
+
+        if (config->stop_before && job->block_num >= config->stop_before) {
+            job->stop = true;
+            connection->pause_read();
+        } else {
+            if (job->block_num <= received_head)
+                job->bulk = false;
+            received_head = job->block_num;
+            job->result   = std::move(result);
+            if (job->bulk) {
+                asio::post(*decode_pool, [this, job] {
+                    try {
+                        block_rows rows;
+                        decode_block(*job, rows);
+                        job->decoded.set_value(std::move(rows));
+                    } catch (...) { job->decoded.set_exception(std::current_exception()); }
+                });
+            }
+        }
+
+        // Reading pauses while the queue is full, so this can't fail unless that breaks; dropping the block would
+        // corrupt the fill
+        if (!jobs.push(job))
+            throw std::runtime_error("block " + std::to_string(job->block_num) + " arrived while the pipeline was full");
+        { std::lock_guard lock(jobs_mutex); }
+        jobs_available.notify_one();
+
+        ++pipeline_jobs;
+        pipeline_bytes += job->frame_size;
+        if (!job->stop && pipeline_full()) {
+            read_paused = true;
+            connection->pause_read();
+            if (!pipeline_full() && read_paused.exchange(false))
+                connection->resume_read();
+        }
+        return true;
+    }
+
+    // Both threads call this; spsc_queue only lets the producer ask for write_available(). pipeline_jobs also counts
+    // the job being written, so it never reports room the queue doesn't have.
+    bool pipeline_full() { return pipeline_jobs >= config->pipeline_blocks || pipeline_bytes >= config->pipeline_memory; }
+
+    // Runs on the io thread. Only used when --fpg-max-in-flight limits the number of unacknowledged messages.
+    void ack_blocks(uint32_t num_messages) {
+        if (config->max_messages_in_flight != 0xffff'ffff)
+            connection->ack_blocks(num_messages);
+    }
+
+    // Runs on the writer thread after a block is written. Acks in batches to keep the number of requests low.
+    void block_written(block_job& job) {
+        job.frame.reset();
+        pipeline_bytes -= job.frame_size;
+        --pipeline_jobs;
+        if (!pipeline_full() && read_paused.exchange(false))
+            asio::post(*ioc, [self = shared_from_this(), this] {
+                if (connection)
+                    connection->resume_read();
+            });
+        if (config->max_messages_in_flight != 0xffff'ffff &&
+            ++unacked >= std::max(config->max_messages_in_flight / 4, 1u)) {
+            asio::post(*ioc, [self = shared_from_this(), this, n = unacked] {
+                if (connection)
+                    ack_blocks(n);
+            });
+            unacked = 0;
+        }
+    }
+
+    void start_pipeline() {
+        decode_pool.emplace(std::max(config->decode_threads, 1u));
+        if (!config->defer_indexes && !segment) {
+            start_trimmer(trim_index_queries(), trim_function_queries());
+        }
+        start_checkpointer();
+        writer = std::thread([this] { write_blocks(); });
+    }
+
+    void start_trimmer(std::vector<index_query> indexes, std::vector<std::string> setup) {
+        if (config->enable_trim)
+            trimmer = std::make_unique<history_trimmer>(
+                quote_name(config->schema), std::move(indexes), std::move(setup), config->trim_chunk, partition_size, first);
+    }
+
+    void start_checkpointer() {
+        if (config->checkpoints.empty() || segment)
+            return;
+        std::vector<checkpoint_table> tables;
+        for (auto& name : config->checkpoints) {
+            auto it = std::find_if(
+                connection->abi.tables.begin(), connection->abi.tables.end(), [&](auto& table) { return table.type == name; });
+            if (it == connection->abi.tables.end() || !delta_tables.count(name))
+                throw std::runtime_error("--fpg-checkpoint: unknown delta table " + name);
+            auto& table   = tables.emplace_back();
+            table.name    = name;
+            table.columns = delta_tables[name].columns;
+            for (auto& k : it->key_names)
+                table.keys += (table.keys.empty() ? "" : ", ") + quote_name(k);
+        }
+        checkpointer = std::make_unique<state_checkpointer>(quote_name(config->schema), std::move(tables), config->checkpoint_step);
+    }
+
+    // With --fpg-defer-indexes, bulk COPY only maintains primary keys. Once the writer gets within index_distance
+    // blocks of irreversible, this builds the other indexes in the background, then starts trimming, which needs them.
+    void update_indexes(const block_job& job) {
+        if (!config->defer_indexes || indexes_built || segment)
+            return;
+        if (!indexes) {
+            if (job.block_num + config->index_distance < job.last_irreversible.block_num)
+                return;
+            ilog("block ${b}: build indexes", ("b", job.block_num));
+            indexes = std::make_unique<index_builder>(deferred_index_queries(), config->index_threads);
+        }
+        if (!indexes->finished())
+            return;
+        indexes->rethrow();
+        indexes.reset();
+        indexes_built = true;
+        ilog("block ${b}: indexes built", ("b", job.block_num));
+        start_trimmer({}, trim_function_queries());
+    }
+
+    void stop_pipeline() {
+        {
+            std::lock_guard lock(jobs_mutex);
+            stopping = true;
+        }
+        jobs_available.notify_all();
+        if (writer.joinable() && writer.get_id() != std::this_thread::get_id())
+            writer.join();
+        if (decode_pool)
+            decode_pool->join();
+        if (!writer.joinable()) {
+            trimmer.reset();
+            checkpointer.reset();
+            indexes.reset();
+        }
+    }
+
+    // Writer thread. Owns sql_connection and the table streams while the pipeline runs.
+    void write_blocks() {
+        try {
+            while (true) {
+                bool idle;
+                {
+                    std::unique_lock lock(jobs_mutex);
+                    idle = !jobs_available.wait_for(lock, config->commit.max_time, [&] { return stopping || jobs.read_available(); });
+                    if (stopping)
+                        return;
+                }
+                // A batch commits after max_time even when no more blocks arrive, so a full spool can release them
+                if (idle) {
+                    close_streams();
+                    continue;
+                }
+                std::shared_ptr<block_job> job;
+                jobs.pop(job);
+                if (!write_block(*job))
+                    break;
+                block_written(*job);
+            }
+        } catch (const std::exception& e) {
+            elog("${e}", ("e", e.what()));
+        } catch (...) {
+            elog("unknown exception");
+        }
+        asio::post(*ioc, [self = shared_from_this(), this] {
+            if (connection)
+                connection->close(false);
+        });
+    }
+
+    void decode_block(block_job& job, block_rows& rows) {
+        state_history::metrics::timer timer(metrics->decode);
+        std::visit([&](auto& result) { decode_block(result, job.bulk, rows); }, job.result);
+    }
 
-        if (config->stop_before && result.this_block->block_num >= config->stop_before) {
+    void decode_block(get_blocks_result_v0& result, bool bulk, block_rows& rows) {
+        if (result.block)
+            receive_block(result.this_block->block_num, result.this_block->block_id, *result.block, bulk, rows);
+        if (result.deltas)
+            receive_deltas(result.this_block->block_num, *result.deltas, bulk, rows);
+        if (result.traces)
+            receive_traces(result.this_block->block_num, *result.traces, bulk, rows);
+    }
+
+    void decode_block(get_blocks_result_v1& result, bool bulk, block_rows& rows) {
+        if (result.block)
+            receive_block(result.this_block->block_num, result.this_block->block_id, result.block.value(), bulk, rows);
+        if (!result.deltas.empty())
+            receive_deltas(result.this_block->block_num, result.deltas, bulk, rows);
+        if (!result.traces.empty())
+            receive_traces(result.this_block->block_num, result.traces, bulk, rows);
+    }
+
+    // Runs on the writer thread, in block order. Returns false when filling should stop.
+    bool write_block(block_job& job) {
+        if (job.stop) {
             close_streams();
-            ilog("block ${b}: stop requested", ("b", result.this_block->block_num));
+            ilog("block ${b}: stop requested", ("b", job.block_num));
             return false;
         }
 
-        if (result.this_block->block_num <= head) {
+        create_partitions(job.block_num);
+        update_indexes(job);
+
+        if (job.block_num <= head) {
             close_streams();
-            ilog("switch forks at block ${b}", ("b", result.this_block->block_num));
-            bulk = false;
+            ilog("switch forks at block ${b}", ("b", job.block_num));
         }
 
-        if (!bulk || large_deltas || !(result.this_block->block_num % 200))
+        if (!job.bulk)
             close_streams();
         if (table_streams.empty())
             trim();
-        if (!bulk)
-            ilog("block ${b}", ("b", result.this_block->block_num));
+        if (!job.bulk)
+            ilog("block ${b}", ("b", job.block_num));
 
         pqxx::work     t(*sql_connection);
         pqxx::pipeline pipeline(t);
-        if (result.this_block->block_num <= head)
-            truncate(t, pipeline, result.this_block->block_num);
-        if (!head_id.empty() && (!result.prev_block || to_string(result.prev_block->block_id) != head_id))
+        if (job.block_num <= head)
+            truncate(t, pipeline, job.block_num);
+        if (!head_id.empty() && (!job.prev_block || to_string(job.prev_block->block_id) != head_id))
             throw std::runtime_error("prev_block does not match");
-        if (result.block)
-            receive_block(result.this_block->block_num, result.this_block->block_id, *result.block, bulk, t, pipeline);
-        if (result.deltas)
-            receive_deltas(result.this_block->block_num, *result.deltas, bulk, t, pipeline);
-        if (result.traces)
-            receive_traces(result.this_block->block_num, *result.traces, bulk, t, pipeline);
 
-        head            = result.this_block->block_num;
-        head_id         = to_string(result.this_block->block_id);
-        irreversible    = result.last_irreversible.block_num;
-        irreversible_id = to_string(result.last_irreversible.block_id);
+        block_rows rows;
+        if (job.bulk)
+            rows = job.rows.get();
+        else
+            decode_block(job, rows);
+        uint64_t stream_bytes = 0;
+        {
+            state_history::metrics::timer timer(metrics->write);
+            count_rows(rows);
+            write_blobs(t, pipeline, rows.blobs);
+            for (auto& [name, data] : rows.streams) {
+                stream_bytes += data.size();
+                write_stream(job.block_num, t, name, std::move(data));
+            }
+            for (auto& [_, queries] : rows.inserts)
+                for (auto& query : queries)
+                    pipeline.insert(query);
+            if (!job.bulk) {
+                record_touched(t, pipeline, job.block_num, rows.tables);
+                update_current(t, pipeline, rows.tables, job.block_num, job.block_num);
+            }
+        }
+
+        head            = job.block_num;
+        head_id         = to_string(job.block_id);
+        irreversible    = job.last_irreversible.block_num;
+        irreversible_id = to_string(job.last_irreversible.block_id);
         if (!first)
             first = head;
-        if (!bulk)
+        if (!job.bulk)
             write_fill_status(t, pipeline);
         pipeline.insert(
             "insert into " + t.quote_name(config->schema) + ".received_block (block_num, block_id) values (" +
-            std::to_string(result.this_block->block_num) + ", " + quote(to_string(result.this_block->block_id)) + ")");
+            std::to_string(job.block_num) + ", " + sql_str(false, in_profile(job.block_id)) + ")");
 
-        pipeline.complete();
-        while(!pipeline.empty())
-            pipeline.retrieve();
-        t.commit();
-        if (large_deltas)
+        {
+            state_history::metrics::timer timer(metrics->commit);
+            pipeline.complete();
+            while (!pipeline.empty())
+                pipeline.retrieve();
+            t.commit();
+        }
+        metrics->blocks.add();
+        metrics->head.set(head);
+        metrics->irreversible.set(irreversible);
+        if (!job.bulk)
+            release_spool();
+        if (job.bulk)
+            batch.add_block(stream_bytes, rows.num_rows);
+        if (job.large_deltas || batch.full())
             close_streams();
+        if (segment && job.block_num + 1 >= segment->end) {
+            close_streams();
+            ilog("backfill segment ${s} done", ("s", segment->segment));
+            return false;
+        }
         return true;
-    } // receive_result()
+    } // write_block
+
+    // Adds a block's rows to the per-table counters
+    void count_rows(const block_rows& rows) {
+        for (auto& [name, n] : rows.table_rows) {
+            uint64_t bytes = 0;
+            if (auto it = rows.streams.find(name); it != rows.streams.end())
+                bytes += it->second.size();
+            if (auto it = rows.inserts.find(name); it != rows.inserts.end())
+                for (auto& query : it->second)
+                    bytes += query.size();
+            auto& table = metrics->table(name);
+            table.rows.add(n);
+            table.bytes.add(bytes);
+            metrics->rows.add(n);
+            metrics->bytes.add(bytes);
+        }
+    }
 
-    void write_stream(uint32_t block_num, pqxx::work& t, const std::string& name, const std::string& values) {
+    void write_stream(uint32_t block_num, pqxx::work& t, const std::string& name, std::string rows) {
         if (!first_bulk)
             first_bulk = block_num;
         auto& ts = table_streams[name];
         if (!ts)
             ts = std::make_unique<table_stream>(t.quote_name(config->schema) + "." + t.quote_name(name));
-        ts->writer.write_raw_line(values);
+        ts->write_rows(std::move(rows));
     }
 
     void close_streams() {
+        batch.clear();
         if (table_streams.empty())
             return;
-        for (auto& [_, ts] : table_streams) {
-            ts->writer.complete();
-            ts->t.commit();
-            ts.reset();
+        state_history::metrics::timer timer(metrics->commit);
+        // Barrier: every stream sends its remaining rows in parallel, then all of them commit
+        for (auto& [_, ts] : table_streams)
+            ts->finish();
+        for (auto& [_, ts] : table_streams)
+            ts->complete();
+        std::set<std::string> tables;
+        for (auto& [name, _] : table_streams)
+            tables.insert(name);
+        {
+            // Recorded before the rows commit, so a restart truncates them if fill_status doesn't get updated
+            pqxx::work     t(*sql_connection);
+            pqxx::pipeline pipeline(t);
+            record_touched(t, pipeline, first_bulk, tables);
+            pipeline.complete();
+            t.commit();
         }
+        for (auto& [_, ts] : table_streams)
+            ts->commit();
         table_streams.clear();
 
         pqxx::work     t(*sql_connection);
         pqxx::pipeline pipeline(t);
         write_fill_status(t, pipeline);
+        update_current(t, pipeline, tables, first_bulk, head);
         pipeline.complete();
         t.commit();
 
         ilog("block ${b} - ${e}", ("b", first_bulk)("e", head));
         first_bulk = 0;
+        release_spool();
+    }
+
+    // Runs on the writer thread once fill_status holds head. The connection's spool can drop the blocks up to it.
+    void release_spool() {
+        if (config->spool_dir.empty())
+            return;
+        asio::post(*ioc, [self = shared_from_this(), this, head = head] {
+            if (connection)
+                connection->committed(head);
+        });
+    }
+
+    // Compiles each delta table's abi into a pg_table once per session, so rows don't walk the abi. The column layout
+    // matches fill_field().
+    void compile_delta_tables(pqxx::work& t) {
+        delta_tables.clear();
+        for (auto& table : connection->abi.tables) {
+            if (table.type == "global_property" || table.type == "chain_config")
+                continue;
+            auto& variant_type = get_type(table.type);
+            if (!variant_type.as_variant() || variant_type.as_variant()->size() != 1 || !variant_type.as_variant()->at(0).type->as_struct())
+                throw std::runtime_error("don't know how to process " + variant_type.name);
+            auto& dt        = delta_tables[table.type];
+            dt.name         = table.type;
+            dt.variant_type = &variant_type;
+            dt.columns      = "block_num, present";
+            for (auto& field : variant_type.as_variant()->at(0).type->as_struct()->fields)
+                compile_field(t, dt, "", field);
+        }
     }
 
-    void fill_value(
-        bool bulk, bool nested_bulk, pqxx::work& t, const std::string& base_name, std::string& fields, std::string& values,
-        eosio::input_stream& bin, const eosio::abi_field& field) {
+    void compile_struct(pqxx::work& t, pg_table& table, const std::string& base_name, const abi_type& type) {
+        for (auto& f : type.as_struct()->fields)
+            compile_field(t, table, base_name, f);
+    }
+
+    void compile_field(pqxx::work& t, pg_table& table, const std::string& base_name, const eosio::abi_field& field) {
         if (field.type->as_struct()) {
-            for (auto& f : field.type->as_struct()->fields)
-                fill_value(bulk, nested_bulk, t, base_name + field.name + "_", fields, values, bin, f);
-        } else if (field.type->optional_of() && field.type->optional_of()->as_struct()) {
-            bool present;
-            bin.read_raw<bool>(present);
-            fields += ", " + t.quote_name(base_name + field.name + "_present");
-            values += sep(bulk) + sql_str(bulk, present);
-            if (present) {
-                for (auto& f : field.type->optional_of()->as_struct()->fields)
-                    fill_value(bulk, nested_bulk, t, base_name + field.name + "_", fields, values, bin, f);
-            } else {
-                for (auto& f : field.type->optional_of()->as_struct()->fields) {
-                    auto it = abi_type_to_sql_type.find(f.type->name);
-                    if (it == abi_type_to_sql_type.end())
-                        throw std::runtime_error("don't know sql type for abi type: " + f.type->name);
-                    if (!it->second.empty_to_sql)
-                        throw std::runtime_error("don't know how to process empty " + field.type->name);
-                    fields += ", " + t.quote_name(base_name + field.name + "_" + f.name);
-                    values += sep(bulk) + it->second.empty_to_sql(*sql_connection, bulk);
-                }
-            }
+            compile_struct(t, table, base_name + field.name + "_", *field.type);
+            return;
+        }
+
+        auto& f = table.fields.emplace_back();
+        if (field.type->optional_of() && field.type->optional_of()->as_struct()) {
+            f.kind        = pg_field::optional_of_struct;
+            f.oid         = type_for<bool>.oid;
+            f.optional_of = std::make_unique<pg_table>();
+            table.add_column(t, base_name + field.name + "_present");
+            compile_struct(t, *f.optional_of, base_name + field.name + "_", *field.type->optional_of());
+            table.add_columns(*f.optional_of);
         } else if (field.type->as_variant() && field.type->as_variant()->at(0).type->as_struct()) {
-            uint32_t v;
-            varuint32_from_bin(v, bin);
-            for (auto& f : *field.type->as_variant()->at(v).type->as_variant())
-                fill_value(bulk, nested_bulk, t, base_name + field.name + "_", fields, values, bin, f);
-        } else if (field.type->array_of() && field.type->array_of()->as_struct()) {
-            fields += ", " + t.quote_name(base_name + field.name);
-            values += sep(bulk) + begin_array(bulk);
-            uint32_t n;
-            varuint32_from_bin(n, bin);
-            for (uint32_t i = 0; i < n; ++i) {
-                if (i)
-                    values += ",";
-                values += begin_object_in_array(bulk);
-                std::string struct_fields;
-                std::string struct_values;
-                for (auto& f : *field.type->array_of()->as_variant())
-                    fill_value(bulk, true, t, "", struct_fields, struct_values, bin, f);
-                if (bulk)
-                    values += struct_values.substr(1);
-                else
-                    values += struct_values.substr(2);
-                values += end_object_in_array(bulk);
+            f.kind = pg_field::variant_of_struct;
+            for (auto& alt : *field.type->as_variant()) {
+                auto& v = f.variant_of.emplace_back();
+                if (!alt.type->as_struct())
+                    continue;
+                v = std::make_unique<pg_table>();
+                compile_struct(t, *v, base_name + field.name + "_", *alt.type);
+                table.add_columns(*v);
             }
-            values += end_array(bulk, t, config->schema, field.type->array_of()->name);
-        } else if (field.type->array_of() && field.type->array_of()->as_variant() && field.type->array_of()->as_variant()->at(0).type->as_struct()) {
-            auto* s = field.type->array_of()->as_variant()->at(0).type;
-            fields += ", " + t.quote_name(base_name + field.name);
-            values += sep(bulk) + begin_array(bulk);
-            uint32_t n;
-            varuint32_from_bin(n, bin);
-            for (uint32_t i = 0; i < n; ++i) {
-                uint32_t idx;
-                varuint32_from_bin(idx, bin);
-                if (idx != 0)
-                    throw std::runtime_error("expected 0 variant index");
-                if (i)
-                    values += ",";
-                values += begin_object_in_array(bulk);
-                std::string struct_fields;
-                std::string struct_values;
-                for (auto& f : *s->as_variant())
-                    fill_value(bulk, true, t, "", struct_fields, struct_values, bin, f);
-                if (bulk)
-                    values += struct_values.substr(1);
-                else
-                    values += struct_values.substr(2);
-                values += end_object_in_array(bulk);
-            }
-            values += end_array(bulk, t, config->schema, s->name);
+        } else if (
+            field.type->array_of() &&
+            (field.type->array_of()->as_struct() ||
+             (field.type->array_of()->as_variant() && field.type->array_of()->as_variant()->at(0).type->as_struct()))) {
+            f.element_is_variant = !field.type->array_of()->as_struct();
+            auto* s     = f.element_is_variant ? field.type->array_of()->as_variant()->at(0).type : field.type->array_of();
+            f.kind      = pg_field::array_of_struct;
+            f.type_name = t.quote_name(config->schema) + "." + t.quote_name(s->name);
+            f.oid       = get_type_oid(s->name);
+            f.array_oid = get_type_oid("_" + s->name);
+            f.array_of  = std::make_unique<pg_table>();
+            table.add_column(t, base_name + field.name);
+            compile_struct(t, *f.array_of, "", *s);
         } else {
-            auto abi_type    = field.type->name;
-            bool is_optional = false;
+            auto abi_type = field.type->name;
             if (abi_type.size() >= 1 && abi_type.back() == '?') {
-                is_optional = true;
+                f.optional = true;
                 abi_type.resize(abi_type.size() - 1);
             }
-            auto it = abi_type_to_sql_type.find(abi_type);
-            if (it == abi_type_to_sql_type.end())
+            auto& types = abi_type_to_sql_type_for(compact);
+            auto  it    = types.find(abi_type);
+            if (it == types.end())
                 throw std::runtime_error("don't know sql type for abi type: " + abi_type);
             if (!it->second.bin_to_sql)
                 throw std::runtime_error("don't know how to process " + field.type->name);
+            f.sql_type  = &it->second;
+            f.oid       = get_type_oid(it->second);
+            f.type_name = field.type->name;
+            f.blob      = blobs && abi_type == "bytes" && is_blob_column(table.name, base_name + field.name);
+            table.add_column(t, base_name + field.name);
+        }
+    } // compile_field
 
-            fields += ", " + t.quote_name(base_name + field.name);
-            if (bulk) {
-                if (nested_bulk)
-                    values += ",";
-                else
-                    values += "\t";
-                if (!is_optional || [&bin]() {bool present; bin.read_raw(present); return present; }())
-                    values += it->second.bin_to_sql(*sql_connection, bulk, bin);
+    // Appends a row's values. In bulk mode values holds binary COPY fields; nested fields belong to a composite value
+    // and are preceded by their type oid.
+    void fill_values(bool bulk, bool nested, const pg_table& table, std::string& values, eosio::input_stream& bin, block_rows& rows) {
+        for (auto& f : table.fields)
+            fill_value(bulk, nested, f, values, bin, rows);
+    }
+
+    void fill_value(bool bulk, bool nested, const pg_field& f, std::string& values, eosio::input_stream& bin, block_rows& rows) {
+        switch (f.kind) {
+        case pg_field::scalar: {
+            bool present = true;
+            if (f.optional)
+                bin.read_raw(present);
+            if (present && f.blob) {
+                eosio::input_stream data;
+                from_bin(data, bin);
+                auto ref = blob_ref(data, rows);
+                if (bulk) {
+                    if (nested)
+                        copy_uint32(values, f.oid);
+                    sql_copy(values, ref);
+                } else {
+                    values += sep(bulk) + type_for<eosio::input_stream>.native_to_sql(*sql_connection, bulk, &ref);
+                }
+            } else if (bulk) {
+                if (nested)
+                    copy_uint32(values, f.oid);
+                if (present)
+                    f.sql_type->bin_to_copy(values, bin);
                 else
-                    values += "\\N";
+                    copy_null(values);
             } else {
-                bool present;
-                bin.read_raw(present);
-                if (!is_optional || present)
-                    values += ", " + it->second.bin_to_sql(*sql_connection, bulk, bin);
+                if (present)
+                    values += sep(bulk) + f.sql_type->bin_to_sql(*sql_connection, bulk, bin);
                 else
-                    values += ", null";
+                    values += sep(bulk) + null_value(bulk);
             }
+            break;
+        }
+        case pg_field::optional_of_struct: {
+            bool present;
+            bin.read_raw<bool>(present);
+            if (bulk) {
+                if (nested)
+                    copy_uint32(values, f.oid);
+                sql_copy(values, present);
+            } else {
+                values += sep(bulk) + sql_str(bulk, present);
+            }
+            if (present)
+                fill_values(bulk, nested, *f.optional_of, values, bin, rows);
+            else
+                fill_empty(bulk, nested, *f.optional_of, values);
+            break;
+        }
+        case pg_field::variant_of_struct: {
+            uint32_t v;
+            varuint32_from_bin(v, bin);
+            if (v >= f.variant_of.size() || !f.variant_of[v])
+                throw std::runtime_error("don't know how to process variant index " + std::to_string(v));
+            for (uint32_t i = 0; i < f.variant_of.size(); ++i) {
+                if (i == v)
+                    fill_values(bulk, nested, *f.variant_of[i], values, bin, rows);
+                else if (f.variant_of[i])
+                    fill_null(bulk, nested, *f.variant_of[i], values);
+            }
+            break;
+        }
+        case pg_field::array_of_struct: {
+            uint32_t n;
+            varuint32_from_bin(n, bin);
+            size_t array_pos = 0;
+            if (bulk) {
+                if (nested)
+                    copy_uint32(values, f.array_oid);
+                array_pos = copy_begin_array(values, f.oid, n);
+            } else {
+                values += sep(bulk) + begin_array(bulk);
+            }
+            std::string struct_values;
+            for (uint32_t i = 0; i < n; ++i) {
+                if (f.element_is_variant) {
+                    uint32_t idx;
+                    varuint32_from_bin(idx, bin);
+                    if (idx != 0)
+                        throw std::runtime_error("expected 0 variant index");
+                }
+                struct_values.clear();
+                fill_values(bulk, true, *f.array_of, struct_values, bin, rows);
+                if (bulk) {
+                    auto elem_pos = copy_begin_field(values);
+                    copy_uint32(values, f.array_of->num_columns);
+                    values += struct_values;
+                    copy_end_field(values, elem_pos);
+                } else {
+                    if (i)
+                        values += ",";
+                    values += begin_object_in_array(bulk) + struct_values.substr(1) + end_object_in_array(bulk);
+                }
+            }
+            if (bulk)
+                copy_end_field(values, array_pos);
+            else
+                values += end_array(bulk, f.type_name);
+            break;
+        }
         }
     } // fill_value
 
+    // Values for the fields of an absent optional struct
+    void fill_empty(bool bulk, bool nested, const pg_table& table, std::string& values) {
+        for (auto& f : table.fields) {
+            if (f.kind != pg_field::scalar || !f.sql_type->empty_to_sql)
+                throw std::runtime_error("don't know how to process empty " + f.type_name);
+            if (bulk) {
+                if (nested)
+                    copy_uint32(values, f.oid);
+                f.sql_type->empty_to_copy(values);
+            } else {
+                values += sep(bulk) + f.sql_type->empty_to_sql(*sql_connection, bulk);
+            }
+        }
+    }
+
+    // Values for the columns of variant alternatives which aren't in use
+    void fill_null(bool bulk, bool nested, const pg_table& table, std::string& values) {
+        for (auto& f : table.fields) {
+            switch (f.kind) {
+            case pg_field::scalar:
+            case pg_field::array_of_struct:
+                if (bulk) {
+                    if (nested)
+                        copy_uint32(values, f.kind == pg_field::scalar ? f.oid : f.array_oid);
+                    copy_null(values);
+                } else {
+                    values += sep(bulk) + null_value(bulk);
+                }
+                break;
+            case pg_field::optional_of_struct:
+                if (bulk) {
+                    if (nested)
+                        copy_uint32(values, f.oid);
+                    copy_null(values);
+                } else {
+                    values += sep(bulk) + null_value(bulk);
+                }
+                fill_null(bulk, nested, *f.optional_of, values);
+                break;
+            case pg_field::variant_of_struct:
+                for (auto& v : f.variant_of)
+                    if (v)
+                        fill_null(bulk, nested, *v, values);
+                break;
+            }
+        }
+    }
+
     void
-    receive_block(uint32_t block_num, const checksum256& block_id, signed_block_variant& block, bool bulk, pqxx::work& t, pqxx::pipeline& pipeline) {
+    receive_block(uint32_t block_num, const checksum256& block_id, signed_block_variant& block, bool bulk, block_rows& rows) {
         std::string fields = "block_num, block_id, timestamp, producer, confirmed, previous, transaction_mroot, action_mroot, "
                              "schedule_version, new_producers_version";
-        std::string values = sql_str(bulk, block_num) + sep(bulk) +                                 //
-                             sql_str(bulk, block_id) + sep(bulk) +                                  //
-                             sql_str(bulk, std::visit([](auto&& arg){return arg.timestamp;}, block)) + sep(bulk) +                           //
-                             sql_str(bulk, std::visit([](auto&& arg){return arg.producer;}, block)) + sep(bulk) +                            //
-                             sql_str(bulk, std::visit([](auto&& arg){return arg.confirmed;}, block)) + sep(bulk) +                           //
-                             sql_str(bulk, std::visit([](auto&& arg){return arg.previous;}, block)) + sep(bulk) +                            //
-                             sql_str(bulk, std::visit([](auto&& arg){return arg.transaction_mroot;}, block)) + sep(bulk) +                   //
-                             sql_str(bulk, std::visit([](auto&& arg){return arg.action_mroot;}, block)) + sep(bulk) +                        //
-                             sql_str(bulk, std::visit([](auto&& arg){return arg.schedule_version;}, block)) + sep(bulk) +                    //
-                             sql_str(bulk, std::visit([](auto&& arg){return arg.new_producers;}, block) ? std::visit([](auto&& arg){return arg.new_producers->version;}, block) : 0); //
+        std::string values = std::visit(
+            [&](auto&& arg) {
+                return sql_values(
+                    bulk, block_num, in_profile(block_id), arg.timestamp, in_profile(arg.producer), arg.confirmed,
+                    in_profile(arg.previous), in_profile(arg.transaction_mroot), in_profile(arg.action_mroot), arg.schedule_version,
+                    arg.new_producers ? arg.new_producers->version : 0);
+            },
+            block);
 
         /*
         if (block.new_producers) {
@@ -786,73 +2254,111 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
         }
         */
 
-        write(block_num, t, pipeline, bulk, "block_info", fields, values);
+        write(block_num, rows, bulk, "block_info", fields, values);
     } // receive_block
 
     void
-    receive_block(uint32_t block_num, const checksum256& block_id, eosio::input_stream bin, bool bulk, pqxx::work& t, pqxx::pipeline& pipeline) {
+    receive_block(uint32_t block_num, const checksum256& block_id, eosio::input_stream bin, bool bulk, block_rows& rows) {
         signed_block_variant block;
         from_bin(block, bin);
-        receive_block(block_num, block_id, block, bulk, t, pipeline);
+        receive_block(block_num, block_id, block, bulk, rows);
 
     }
 
-    void receive_deltas(uint32_t block_num, const std::vector<std::variant<table_delta_v0, table_delta_v1>>&& traces, bool bulk, pqxx::work& t, pqxx::pipeline& pipeline) {
-        for(auto t_delta : traces) {
-            write_table_delta(block_num, t_delta, bulk, t, pipeline);
+    // Decodes one delta at a time. Rows refer to the received message instead of being copied.
+    template <typename T>
+    void receive_deltas(uint32_t block_num, eosio::opaque<T> deltas, bool bulk, block_rows& rows) {
+        for (size_t i = 0, n = deltas.unpacked_size(); i < n; ++i) {
+            table_delta t_delta;
+            deltas.unpack_next(t_delta);
+            std::visit(
+                [&](auto& t_delta) {
+                    auto* table = get_delta_table(t_delta.name);
+                    if (!table)
+                        return;
+                    auto filtered = filter_table(config->delta_filters, t_delta.name);
+                    if (filtered == delta_filter_result::exclude)
+                        return;
+                    size_t num_processed = 0;
+                    for (auto& row : t_delta.rows) {
+                        log_delta_progress(block_num, t_delta.name, num_processed++, t_delta.rows.size(), bulk);
+                        if (filtered == delta_filter_result::per_row &&
+                            !filter_row(config->delta_filters, t_delta.name, row.data.pos, row.data.end))
+                            continue;
+                        write_delta_row(block_num, *table, row.present, row.data, bulk, rows);
+                    }
+                },
+                t_delta);
         }
     }
 
-    void receive_deltas(uint32_t block_num, eosio::input_stream bin, bool bulk, pqxx::work& t, pqxx::pipeline& pipeline) {
+    // Decodes one row at a time. A table_delta (v0 or v1) is a variant index, the table name, and a vector of rows;
+    // each row is a present flag and the row's bytes.
+    void receive_deltas(uint32_t block_num, eosio::input_stream bin, bool bulk, block_rows& rows) {
         uint32_t num;
         varuint32_from_bin(num, bin);
         for (uint32_t i = 0; i < num; ++i) {
-            table_delta t_delta;
-            from_bin(t_delta, bin);
-            write_table_delta(block_num, t_delta, bulk, t, pipeline);
+            uint32_t version;
+            varuint32_from_bin(version, bin);
+            if (version > 1)
+                throw std::runtime_error("don't know how to process table_delta variant " + std::to_string(version));
+            std::string name;
+            from_bin(name, bin);
+            uint32_t num_rows;
+            varuint32_from_bin(num_rows, bin);
+            auto* table    = get_delta_table(name);
+            auto  filtered = table ? filter_table(config->delta_filters, name) : delta_filter_result::exclude;
+            for (uint32_t j = 0; j < num_rows; ++j) {
+                uint8_t             present;
+                eosio::input_stream data;
+                bin.read_raw(present);
+                from_bin(data, bin);
+                if (filtered == delta_filter_result::exclude)
+                    continue;
+                log_delta_progress(block_num, name, j, num_rows, bulk);
+                if (filtered == delta_filter_result::per_row && !filter_row(config->delta_filters, name, data.pos, data.end))
+                    continue;
+                write_delta_row(block_num, *table, present, data, bulk, rows);
+            }
         }
     }
 
-    void write_table_delta(uint32_t block_num, table_delta& t_delta, bool bulk, pqxx::work& t, pqxx::pipeline& pipeline) {
-        if (std::visit([](auto&& arg){return arg.name;}, t_delta) == "global_property")
-            return;
+    // Returns nullptr for tables which aren't filled
+    const pg_table* get_delta_table(const std::string& name) {
+        if (name == "global_property" || name == "chain_config")
+            return nullptr;
+        auto it = delta_tables.find(name);
+        if (it == delta_tables.end())
+            throw std::runtime_error("don't know how to process " + name);
+        return &it->second;
+    }
 
-        if (std::visit([](auto&& arg){return arg.name;}, t_delta) == "chain_config")
-            return;
+    void log_delta_progress(uint32_t block_num, const std::string& name, size_t num_processed, size_t num_rows, bool bulk) {
+        if (num_rows > 10000 && !(num_processed % 10000))
+            ilog("block ${b} ${t} ${n} of ${r} bulk=${bulk}", ("b", block_num)("t", name)("n", num_processed)("r", num_rows)("bulk", bulk));
+    }
 
-        auto& variant_type = get_type(std::visit([](auto&& arg){return arg.name;}, t_delta));
-        if (!variant_type.as_variant() || variant_type.as_variant()->size() != 1 || !variant_type.as_variant()->at(0).type->as_struct())
-            throw std::runtime_error("don't know how to process " + variant_type.name);
-
-        std::visit([&block_num, &bulk, &t, &pipeline, this](auto t_delta){
-            size_t num_processed = 0;
-            auto& variant_type = get_type(t_delta.name);
-            auto& type = *variant_type.as_variant()->at(0).type;
-            for (auto& row : t_delta.rows) {
-                if (t_delta.rows.size() > 10000 && !(num_processed % 10000))
-                    ilog("block ${b} ${t} ${n} of ${r} bulk=${bulk}",
-                         ("b", block_num)("t", t_delta.name)("n", num_processed)("r", t_delta.rows.size())("bulk", bulk));
-                check_variant(row.data, variant_type, 0u);
-                std::string fields = "block_num, present";
-                std::string values = std::to_string(block_num) + sep(bulk) + sql_str(bulk, row.present);
-                for (auto& field : type.as_struct()->fields)
-                    fill_value(bulk, false, t, "", fields, values, row.data, field);
-                write(block_num, t, pipeline, bulk, t_delta.name, fields, values);
-                ++num_processed;
-            }
-        },
-        t_delta);
+    void write_delta_row(
+        uint32_t block_num, const pg_table& table, bool present, eosio::input_stream data, bool bulk, block_rows& rows) {
+        check_variant(data, *table.variant_type, 0u);
+        std::string values = sql_values(bulk, block_num, present);
+        fill_values(bulk, false, table, values, data, rows);
+        write(block_num, rows, bulk, table.name, table.columns, values);
     }
 
-    void receive_traces(uint32_t block_num, const std::vector<std::variant<transaction_trace_v0>>&& traces, bool bulk, pqxx::work& t, pqxx::pipeline& pipeline) {
+    // Decodes one transaction trace at a time
+    template <typename T>
+    void receive_traces(uint32_t block_num, eosio::opaque<T> traces, bool bulk, block_rows& rows) {
         uint32_t num_ordinals = 0;
-        for (auto trace : traces) {
+        for (size_t i = 0, n = traces.unpacked_size(); i < n; ++i) {
+            transaction_trace trace;
+            traces.unpack_next(trace);
             if (filter(config->trx_filters, std::get<0>(trace)))
-                write_transaction_trace(block_num, num_ordinals, std::get<transaction_trace_v0>(trace), bulk, t, pipeline);
+                write_transaction_trace(block_num, num_ordinals, std::get<transaction_trace_v0>(trace), bulk, rows);
         }
     }
 
-    void receive_traces(uint32_t block_num, eosio::input_stream bin, bool bulk, pqxx::work& t, pqxx::pipeline& pipeline) {
+    void receive_traces(uint32_t block_num, eosio::input_stream bin, bool bulk, block_rows& rows) {
         uint32_t num;
         uint32_t num_ordinals = 0;
         varuint32_from_bin(num, bin);
@@ -860,227 +2366,259 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
             transaction_trace trace;
             from_bin(trace, bin);
             if (filter(config->trx_filters, std::get<0>(trace)))
-                write_transaction_trace(block_num, num_ordinals, std::get<transaction_trace_v0>(trace), bulk, t, pipeline);
+                write_transaction_trace(block_num, num_ordinals, std::get<transaction_trace_v0>(trace), bulk, rows);
         }
     }
 
     void write_transaction_trace(
-        uint32_t block_num, uint32_t& num_ordinals, transaction_trace_v0& ttrace, bool bulk, pqxx::work& t, pqxx::pipeline& pipeline) {
+        uint32_t block_num, uint32_t& num_ordinals, transaction_trace_v0& ttrace, bool bulk, block_rows& rows) {
         auto* failed = !ttrace.failed_dtrx_trace.empty() ? &std::get<transaction_trace_v0>(ttrace.failed_dtrx_trace[0].recurse) : nullptr;
         if (failed) {
             if (!filter(config->trx_filters, *failed))
                 return;
-            write_transaction_trace(block_num, num_ordinals, *failed, bulk, t, pipeline);
+            write_transaction_trace(block_num, num_ordinals, *failed, bulk, rows);
         }
-        auto        transaction_ordinal = ++num_ordinals;
-        std::string failed_id           = failed ? to_string(failed->id) : "";
+        int32_t     transaction_ordinal = ++num_ordinals;
         std::string fields              = "block_num, transaction_ordinal, failed_dtrx_trace";
-        std::string values =
-            std::to_string(block_num) + sep(bulk) + std::to_string(transaction_ordinal) + sep(bulk) + quote(bulk, failed_id);
+        std::string values = sql_values(bulk, block_num, transaction_ordinal, in_profile(failed ? failed->id : eosio::checksum256{}));
         std::string suffix_fields = ", partial_signatures, partial_context_free_data";
-        std::string suffix_values = sep(bulk) + begin_array(bulk);
+
+        std::vector<eosio::signature>    signatures;
+        std::vector<eosio::input_stream> context_free_data;
         if (ttrace.partial) {
             if (std::holds_alternative<partial_transaction_v0>(*ttrace.partial)) {
                 auto& partial = std::get<partial_transaction_v0>(*ttrace.partial);
-                for (auto& sig : partial.signatures) {
-                    if (&sig != &partial.signatures[0])
-                        suffix_values += ",";
-                    suffix_values += native_to_sql<abieos::signature>(*sql_connection, bulk, &sig);
-                }
+                signatures    = partial.signatures;
+                context_free_data.assign(partial.context_free_data.begin(), partial.context_free_data.end());
             }
             else {
                 auto& partial = std::get<partial_transaction_v1>(*ttrace.partial);
                 if (partial.prunable_data) {
-                    if (!std::holds_alternative<prunable_data_type::none>(partial.prunable_data->prunable_data)) {
-                        auto sig_extractor = [](auto&& arg) {
-                            using T = std::decay_t<decltype(arg)>;
-                            if constexpr (std::is_same_v<T, prunable_data_type::none>)
-                                return std::vector<eosio::signature>();
-                            else if constexpr (std::is_same_v<T, prunable_data_type::full_legacy>)
-                                return arg.signatures;
-                            else if constexpr (std::is_same_v<T, prunable_data_type::partial>)
-                                return arg.signatures;
-                            else if constexpr (std::is_same_v<T, prunable_data_type::full>)
-                                return arg.signatures;
-                            else
-                                throw std::runtime_error("don't know how to handle new prunable_data variant");
-                        };
-                        const auto& signatures = std::visit(sig_extractor, partial.prunable_data->prunable_data);
-                        for (auto& sig : signatures) {
-                            if (&sig != &signatures[0])
-                                suffix_values += ",";
-                            suffix_values += native_to_sql<abieos::signature>(*sql_connection, bulk, &sig);
-                        }
+                    auto sig_extractor = [](auto&& arg) {
+                        using T = std::decay_t<decltype(arg)>;
+                        if constexpr (std::is_same_v<T, prunable_data_type::none>)
+                            return std::vector<eosio::signature>();
+                        else if constexpr (std::is_same_v<T, prunable_data_type::full_legacy>)
+                            return arg.signatures;
+                        else if constexpr (std::is_same_v<T, prunable_data_type::partial>)
+                            return arg.signatures;
+                        else if constexpr (std::is_same_v<T, prunable_data_type::full>)
+                            return arg.signatures;
+                        else
+                            throw std::runtime_error("don't know how to handle new prunable_data variant");
+                    };
+                    signatures = std::visit(sig_extractor, partial.prunable_data->prunable_data);
+                    if (std::holds_alternative<prunable_data_type::full>(partial.prunable_data->prunable_data)) {
+                        auto& full = std::get<prunable_data_type::full>(partial.prunable_data->prunable_data);
+                        context_free_data.assign(full.context_free_segments.begin(), full.context_free_segments.end());
                     }
-                    else
-                        suffix_values += "";
                 }
-                else
-                    suffix_values += "";
             }
         }
-        suffix_values += end_array(bulk, "varchar") + sep(bulk) + begin_array(bulk);
-        if (ttrace.partial) {
-            if (std::holds_alternative<partial_transaction_v0>(*ttrace.partial)) {
-                auto& partial = std::get<partial_transaction_v0>(*ttrace.partial);
-                for (auto& cfd : partial.context_free_data) {
-                    if (&cfd != &partial.context_free_data[0])
-                        suffix_values += ",";
-                    suffix_values += native_to_sql<eosio::input_stream>(*sql_connection, bulk, &cfd);
-                }
+
+        std::string suffix_values;
+        if (bulk) {
+            auto pos = copy_begin_array(suffix_values, type_for<abieos::signature>.oid, signatures.size());
+            for (auto& sig : signatures)
+                sql_copy(suffix_values, sig);
+            copy_end_field(suffix_values, pos);
+            pos = copy_begin_array(suffix_values, type_for<eosio::input_stream>.oid, context_free_data.size());
+            for (auto& cfd : context_free_data)
+                sql_copy(suffix_values, cfd);
+            copy_end_field(suffix_values, pos);
+        } else {
+            suffix_values = sep(bulk) + begin_array(bulk);
+            for (auto& sig : signatures) {
+                if (&sig != &signatures[0])
+                    suffix_values += ",";
+                suffix_values += native_to_sql<abieos::signature>(*sql_connection, bulk, &sig);
             }
-            else if (std::holds_alternative<partial_transaction_v1>(*ttrace.partial)) {
-                auto& partial = std::get<partial_transaction_v1>(*ttrace.partial);
-                if (partial.prunable_data) {
-                    if (std::holds_alternative<prunable_data_type::full>(partial.prunable_data->prunable_data)) {
-                        auto& context_free_data = std::get<prunable_data_type::full>(partial.prunable_data->prunable_data);
-                        for (auto& cfd : context_free_data.context_free_segments) {
-                            if (&cfd != &context_free_data.context_free_segments[0])
-                                suffix_values += ",";
-                            suffix_values += native_to_sql<eosio::input_stream>(*sql_connection, bulk, &cfd);
-                        }
-                    }
-                }
+            suffix_values += end_array(bulk, "varchar") + sep(bulk) + begin_array(bulk);
+            for (auto& cfd : context_free_data) {
+                if (&cfd != &context_free_data[0])
+                    suffix_values += ",";
+                suffix_values += native_to_sql<eosio::input_stream>(*sql_connection, bulk, &cfd);
             }
+            suffix_values += end_array(bulk, "bytea");
         }
-        suffix_values += end_array(bulk, "bytea");
         write(
-            "transaction_trace", block_num, ttrace, std::move(fields), std::move(values), bulk, t, pipeline, std::move(suffix_fields),
+            "transaction_trace", block_num, ttrace, std::move(fields), std::move(values), bulk, rows, std::move(suffix_fields),
             std::move(suffix_values));
 
         for (auto& atrace : ttrace.action_traces)
-            write_action_trace(block_num, ttrace, atrace, bulk, t, pipeline);
+            write_action_trace(block_num, ttrace, atrace, bulk, rows);
     } // write_transaction_trace
 
     void write_action_trace(
-        uint32_t block_num, transaction_trace_v0& ttrace, action_trace& atrace, bool bulk, pqxx::work& t, pqxx::pipeline& pipeline) {
+        uint32_t block_num, transaction_trace_v0& ttrace, action_trace& atrace, bool bulk, block_rows& rows) {
 
         std::string fields = "block_num, transaction_id, transaction_status";
-        std::string values =
-            std::to_string(block_num) + sep(bulk) + quote(bulk, to_string(ttrace.id)) + sep(bulk) + quote(bulk, to_string(ttrace.status));
+        std::string values = sql_values(bulk, block_num, in_profile(ttrace.id), ttrace.status);
 
         if (std::get_if<0>(&atrace))
-            write("action_trace", block_num, std::get<0>(atrace), fields, values, bulk, t, pipeline);
+            write("action_trace", block_num, std::get<0>(atrace), fields, values, bulk, rows);
         else if (std::get_if<1>(&atrace))
-            write("action_trace_v1", block_num, std::get<1>(atrace), fields, values, bulk, t, pipeline);
+            write("action_trace_v1", block_num, std::get<1>(atrace), fields, values, bulk, rows);
         write_action_trace_subtable(
-            "action_trace_authorization", block_num, ttrace, std::visit([](auto&& arg){return arg.action_ordinal.value;}, atrace), std::visit([](auto&& arg){ return arg.act.authorization;}, atrace), bulk, t, pipeline);
+            "action_trace_authorization", block_num, ttrace, std::visit([](auto&& arg){return arg.action_ordinal.value;}, atrace), std::visit([](auto&& arg){ return arg.act.authorization;}, atrace), bulk, rows);
         if (std::visit([](auto&& arg){ return arg.receipt;}, atrace))
             write_action_trace_subtable(
                 "action_trace_auth_sequence", block_num, ttrace, std::visit([](auto&& arg){return arg.action_ordinal.value;}, atrace),
-                std::get<action_receipt_v0>(*std::visit([](auto&& arg){return arg.receipt;}, atrace)).auth_sequence, bulk, t, pipeline);
+                std::get<action_receipt_v0>(*std::visit([](auto&& arg){return arg.receipt;}, atrace)).auth_sequence, bulk, rows);
         write_action_trace_subtable(
-            "action_trace_ram_delta", block_num, ttrace, std::visit([](auto&& arg){return arg.action_ordinal.value;}, atrace), std::visit([](auto&& arg){return arg.account_ram_deltas;}, atrace), bulk, t, pipeline);
+            "action_trace_ram_delta", block_num, ttrace, std::visit([](auto&& arg){return arg.action_ordinal.value;}, atrace), std::visit([](auto&& arg){return arg.account_ram_deltas;}, atrace), bulk, rows);
     } // write_action_trace
 
     template <typename T>
     void write_action_trace_subtable(
         const std::string& name, uint32_t block_num, transaction_trace_v0& ttrace, int32_t action_ordinal, const T&& objects, bool bulk,
-        pqxx::work& t, pqxx::pipeline& pipeline) {
+        block_rows& rows) {
 
         int32_t num = 0;
         for (auto& obj : objects)
-            write_action_trace_subtable(name, block_num, ttrace, action_ordinal, num, obj, bulk, t, pipeline);
+            write_action_trace_subtable(name, block_num, ttrace, action_ordinal, num, obj, bulk, rows);
     }
 
     template <typename T>
     void write_action_trace_subtable(
         const std::string& name, uint32_t block_num, transaction_trace_v0& ttrace, int32_t action_ordinal, int32_t& num, T& obj, bool bulk,
-        pqxx::work& t, pqxx::pipeline& pipeline) {
+        block_rows& rows) {
         ++num;
         std::string fields = "block_num, transaction_id, action_ordinal, ordinal, transaction_status";
-        std::string values = std::to_string(block_num) + sep(bulk) + quote(bulk, to_string(ttrace.id)) + sep(bulk) +
-                             std::to_string(action_ordinal) + sep(bulk) + std::to_string(num) + sep(bulk) +
-                             quote(bulk, to_string(ttrace.status));
+        std::string values = sql_values(bulk, block_num, in_profile(ttrace.id), action_ordinal, num, ttrace.status);
 
-        write(name, block_num, obj, fields, values, bulk, t, pipeline);
+        write(name, block_num, obj, fields, values, bulk, rows);
     }
 
     void write(
-        uint32_t block_num, pqxx::work& t, pqxx::pipeline& pipeline, bool bulk, const std::string& name, const std::string& fields,
-        const std::string& values) {
+        uint32_t block_num, block_rows& rows, bool bulk, const std::string& name, const std::string& fields, const std::string& values) {
+        rows.tables.insert(name);
+        ++rows.table_rows[name];
         if (bulk) {
-            write_stream(block_num, t, name, values);
+            auto& stream = rows.streams[name];
+            copy_uint16(stream, copy_count_fields(values));
+            stream += values;
+            ++rows.num_rows;
         } else {
-            std::string query =
-                "insert into " + t.quote_name(config->schema) + "." + t.quote_name(name) + "(" + fields + ") values (" + values + ")";
-            pipeline.insert(query);
+            // Rows of a table share a statement while their columns match
+            auto  prefix  = "insert into " + quote_name(config->schema) + "." + quote_name(name) + "(" + fields + ") values (";
+            auto& queries = rows.inserts[name];
+            if (queries.empty() || queries.back().size() >= max_insert_size || queries.back().compare(0, prefix.size(), prefix))
+                queries.push_back(prefix + values + ")");
+            else
+                queries.back() += ", (" + values + ")";
         }
     }
 
+    // table is the name of the table the row goes to
     template <typename T>
     void write_table_field(
-        const T& obj, std::string& fields, std::string& values, const std::string& field_name, bool bulk, pqxx::work& t,
-        pqxx::pipeline& pipeline) {
+        const std::string& table, const T& obj, std::string& fields, std::string& values, const std::string& field_name, bool bulk,
+        block_rows& rows) {
         if constexpr (is_known_type(type_for<T>)) {
-            fields += ", " + t.quote_name(field_name);
-            values += sep(bulk) + type_for<T>.native_to_sql(*sql_connection, bulk, &obj);
+            fields += ", " + quote_name(field_name);
+            auto write_value = [&](const T& v) {
+                if (bulk)
+                    sql_type<T>().native_to_copy(values, &v);
+                else
+                    values += sep(bulk) + sql_type<T>().native_to_sql(*sql_connection, bulk, &v);
+            };
+            if constexpr (std::is_same_v<T, eosio::input_stream>) {
+                if (blobs && is_blob_column(table, field_name))
+                    return write_value(blob_ref(obj, rows));
+            }
+            write_value(obj);
         } else if constexpr (is_optional_v<T>) {
-            fields += ", "s + t.quote_name(field_name + "_present");
+            fields += ", "s + quote_name(field_name + "_present");
             bool hv = obj.has_value();
-            values += sep(bulk) + type_for<bool>.native_to_sql(*sql_connection, bulk, &hv);
-            write_table_field(obj ? *obj : typename T::value_type{}, fields, values, field_name, bulk, t, pipeline);
+            if (bulk)
+                type_for<bool>.native_to_copy(values, &hv);
+            else
+                values += sep(bulk) + type_for<bool>.native_to_sql(*sql_connection, bulk, &hv);
+            write_table_field(table, obj ? *obj : typename T::value_type{}, fields, values, field_name, bulk, rows);
         } else if constexpr (is_variant_v<T>) {
-            fields += ", "s + t.quote_name(field_name + "_variant_populated");
+            fields += ", "s + quote_name(field_name + "_variant_populated");
             int in_use = obj.index();
-            values += sep(bulk) + type_for<int>.native_to_sql(*sql_connection, bulk, &in_use);
+            if (bulk)
+                type_for<int>.native_to_copy(values, &in_use);
+            else
+                values += sep(bulk) + type_for<int>.native_to_sql(*sql_connection, bulk, &in_use);
             variant_for_each(obj, [&](size_t index, auto&& arg) {
-                write_table_fields(arg, fields, values, field_name + std::to_string(index) + "_", bulk, t, pipeline);
+                write_table_fields(table, arg, fields, values, field_name + std::to_string(index) + "_", bulk, rows);
             });
         } else if constexpr (is_vector_v<T>) {
         } else {
-            write_table_fields<T>(obj, fields, values, field_name + "_", bulk, t, pipeline);
+            write_table_fields<T>(table, obj, fields, values, field_name + "_", bulk, rows);
         }
     }
 
     template <typename T>
     void write_table_fields(
-        const T& obj, std::string& fields, std::string& values, const std::string& prefix, bool bulk, pqxx::work& t,
-        pqxx::pipeline& pipeline) {
+        const std::string& table, const T& obj, std::string& fields, std::string& values, const std::string& prefix, bool bulk,
+        block_rows& rows) {
         eosio::for_each_field<T>([&](const std::string_view field_name, auto member) {
-            write_table_field(member(&obj), fields, values, prefix + (std::string)field_name, bulk, t, pipeline);
+            write_table_field(table, member(&obj), fields, values, prefix + (std::string)field_name, bulk, rows);
         });
     }
 
     template <typename T>
     void write(
-        const std::string& name, uint32_t block_num, T& obj, std::string fields, std::string values, bool bulk, pqxx::work& t,
-        pqxx::pipeline& pipeline, std::string suffix_fields = "", std::string suffix_values = "") {
+        const std::string& name, uint32_t block_num, T& obj, std::string fields, std::string values, bool bulk, block_rows& rows,
+        std::string suffix_fields = "", std::string suffix_values = "") {
 
-        write_table_fields(obj, fields, values, "", bulk, t, pipeline);
+        write_table_fields(name, obj, fields, values, "", bulk, rows);
         fields += suffix_fields;
         values += suffix_values;
-        write(block_num, t, pipeline, bulk, name, fields, values);
+        write(block_num, rows, bulk, name, fields, values);
     } // write
 
+    // With --fpg-blob-store, content of exactly 32 bytes or at least --fpg-blob-min-size bytes goes into the blob table
+    // and the row holds its sha256. Returns the value the row holds; it points into rows.
+    eosio::input_stream blob_ref(eosio::input_stream data, block_rows& rows) {
+        if (data.end == data.pos || (data.end - data.pos != 32 && data.end - data.pos < config->blob_min_size))
+            return data;
+        auto hash = fc::sha256::hash(data.pos, data.end - data.pos);
+        auto it   = rows.blobs.try_emplace(std::string(hash.data(), hash.data_size()), data.pos, data.end).first;
+        return {it->first.data(), it->first.data() + it->first.size()};
+    }
+
+    // Inserts the blobs this session hasn't written yet. Blobs outlive forks and trimming, so a written blob stays
+    // written.
+    void write_blobs(pqxx::work& t, pqxx::pipeline& pipeline, const std::map<std::string, std::string>& block_blobs) {
+        if (written_blobs.size() >= max_written_blobs)
+            written_blobs.clear();
+        for (auto& [hash, data] : block_blobs) {
+            if (!written_blobs.insert(hash).second)
+                continue;
+            pipeline.insert(
+                "insert into " + t.quote_name(config->schema) + ".blob (hash, data) values (" +
+                quote_bytea(false, abieos::hex(hash.begin(), hash.end())) + ", " + quote_bytea(false, abieos::hex(data.begin(), data.end())) +
+                ") on conflict do nothing");
+        }
+    }
+
+    // Hands the committed, irreversible blocks to the trimmer and the checkpointer
     void trim() {
-        if (!config->enable_trim)
-            return;
-        auto end_trim = std::min(head, irreversible);
-        if (first >= end_trim)
-            return;
-        create_trim();
-        pqxx::work t(*sql_connection);
-        ilog("trim  ${b} - ${e}", ("b", first)("e", end_trim));
-        t.exec(
-            "select * from " + t.quote_name(config->schema) + ".trim_history(" + std::to_string(first) + ", " + std::to_string(end_trim) +
-            ")");
-        t.commit();
-        ilog("      done");
-        first = end_trim;
+        if (trimmer)
+            trimmer->request(std::min(head, irreversible));
+        if (checkpointer)
+            checkpointer->request(std::min(head, irreversible));
     }
 
     const abi_type& get_type(const std::string& name) { return connection->get_type(name); }
 
     void closed(bool retry) override {
-        if (my) {
+        stop_pipeline();
+        if (my && segment) {
+            my->segment_closed(*segment, head + 1 >= segment->end, retry);
+        } else if (my) {
             my->session.reset();
             if (retry)
                 my->schedule_retry();
         }
     }
 
-    ~fpg_session() {}
+    ~fpg_session() { stop_pipeline(); }
 }; // fpg_session
 
 static abstract_plugin& _fill_postgresql_plugin = app().register_plugin<fill_pg_plugin>();
@@ -1088,6 +2626,9 @@ static abstract_plugin& _fill_postgresql_plugin = app().register_plugin<fill_pg_
 fill_postgresql_plugin_impl::~fill_postgresql_plugin_impl() {
     if (session)
         session->my = nullptr;
+    for (auto& [_, s] : segment_sessions)
+        if (s)
+            s->my = nullptr;
 }
 
 void fill_postgresql_plugin_impl::start() {
@@ -1095,6 +2636,45 @@ void fill_postgresql_plugin_impl::start() {
     session->start(app().get_io_service());
 }
 
+void fill_postgresql_plugin_impl::start_backfill(const std::vector<backfill_segment>& segments) {
+    backfill_failed = false;
+    for (auto& segment : segments)
+        start_segment(segment);
+}
+
+void fill_postgresql_plugin_impl::start_segment(const backfill_segment& segment) {
+    ilog("backfill segment ${s}: ${b} - ${e}", ("s", segment.segment)("b", segment.begin)("e", segment.end - 1));
+    auto& s = segment_sessions[segment.segment];
+    s       = std::make_shared<fpg_session>(this, segment);
+    s->start(app().get_io_service());
+}
+
+// Restarts segments which lost their connection. Once every segment is done, a single session stitches them together
+// and continues live.
+void fill_postgresql_plugin_impl::segment_closed(const backfill_segment& segment, bool done, bool retry) {
+    if (!segment_sessions.erase(segment.segment))
+        return;
+    if (!done && retry) {
+        auto retry_timer = std::make_shared<boost::asio::deadline_timer>(app().get_io_service(), boost::posix_time::seconds(1));
+        segment_sessions[segment.segment]; // placeholder until the retry starts
+        retry_timer->async_wait([this, retry_timer, segment](auto& ec) {
+            if (!ec && segment_sessions.count(segment.segment)) {
+                ilog("retry backfill segment ${s}...", ("s", segment.segment));
+                start_segment(segment);
+            }
+        });
+        return;
+    }
+    if (!done) {
+        elog("backfill segment ${s} failed", ("s", segment.segment));
+        backfill_failed = true;
+    }
+    if (segment_sessions.empty() && !backfill_failed) {
+        ilog("backfill done");
+        start();
+    }
+}
+
 fill_pg_plugin::fill_pg_plugin()
     : my(std::make_shared<fill_postgresql_plugin_impl>()) {}
 
@@ -1104,6 +2684,22 @@ void fill_pg_plugin::set_program_options(options_description& cli, options_descr
     auto clop = cli.add_options();
     clop("fpg-drop", "Drop (delete) schema and tables");
     clop("fpg-create", "Create schema and tables");
+    clop("fpg-compact", "With --fpg-create, store checksums as bytea and names as bigint");
+    clop("fpg-blob-store", "With --fpg-create, store ABIs, contract code and large action data once per sha256 in a blob table");
+    clop("fpg-blob-min-size", bpo::value<uint32_t>()->default_value(256), "With --fpg-blob-store, keep values smaller than [arg] bytes in their rows");
+    clop("fpg-decode-threads", bpo::value<uint32_t>()->default_value(4), "Number of threads which decode blocks during bulk fill; with --fill-log-dir, also the number which inflate log entries");
+    clop("fpg-pipeline-blocks", bpo::value<uint32_t>()->default_value(64), "Maximum number of received blocks waiting to be written");
+    clop("fpg-pipeline-memory", bpo::value<uint32_t>()->default_value(1024), "Stop reading from nodeos while received blocks waiting to be written use more than [arg] MiB");
+    clop("fpg-partition-size", bpo::value<uint32_t>()->default_value(0), "With --fpg-create, partition history tables by block_num into ranges of [arg] blocks; 0 for unpartitioned tables");
+    clop("fpg-defer-indexes", "Don't maintain secondary indexes during catch-up; build them once near head");
+    clop("fpg-index-distance", bpo::value<uint32_t>()->default_value(1000), "With --fpg-defer-indexes, build indexes once within [arg] blocks of irreversible");
+    clop("fpg-index-threads", bpo::value<uint32_t>()->default_value(4), "With --fpg-defer-indexes, number of connections which build indexes");
+    clop("fpg-backfill", bpo::value<uint32_t>()->default_value(0), "Fill the blocks before irreversible in [arg] parallel segments, each with its own nodeos connection; 0 to disable");
+    clop("fpg-current-tables", "Maintain a <table>_current table holding the present rows of each delta table as of head");
+    clop("fpg-checkpoint", bpo::value<std::vector<std::string>>(), "Build state checkpoints of delta table [arg]; may be repeated");
+    clop("fpg-checkpoint-interval", bpo::value<uint32_t>()->default_value(1'000'000), "With --fpg-checkpoint, build a checkpoint every [arg] irreversible blocks");
+    clop("fpg-trim-chunk", bpo::value<uint32_t>()->default_value(10000), "Trim at most [arg] blocks per transaction");
+    clop("fpg-max-in-flight", bpo::value<uint32_t>()->default_value(256), "Maximum number of blocks nodeos sends ahead of the blocks written; 0 for unlimited");
 }
 
 void fill_pg_plugin::plugin_initialize(const variables_map& options) {
@@ -1114,24 +2710,69 @@ void fill_pg_plugin::plugin_initialize(const variables_map& options) {
 
         auto port                 = endpoint.substr(endpoint.find(':') + 1, endpoint.size());
         auto host                 = endpoint.substr(0, endpoint.find(':'));
-        my->config->host          = host;
-        my->config->port          = port;
-        my->config->schema        = options["pg-schema"].as<std::string>();
-        my->config->skip_to       = options.count("fill-skip-to") ? options["fill-skip-to"].as<uint32_t>() : 0;
-        my->config->stop_before   = options.count("fill-stop") ? options["fill-stop"].as<uint32_t>() : 0;
-        my->config->trx_filters   = fill_plugin::get_trx_filters(options);
-        my->config->drop_schema   = options.count("fpg-drop");
-        my->config->create_schema = options.count("fpg-create");
-        my->config->enable_trim   = options.count("fill-trim");
+        my->config->host            = host;
+        my->config->port            = port;
+        my->config->log_dir         = options.count("fill-log-dir") ? options["fill-log-dir"].as<std::string>() : "";
+        my->config->log_abi         = options.count("fill-log-abi") ? options["fill-log-abi"].as<std::string>() : "";
+        my->config->record_to       = options.count("fill-record") ? options["fill-record"].as<std::string>() : "";
+        my->config->spool_dir       = options.count("fill-spool-dir") ? options["fill-spool-dir"].as<std::string>() : "";
+        my->config->spool_max_bytes = uint64_t(options["fill-spool-mb"].as<uint32_t>()) * 1024 * 1024;
+        my->config->schema          = options["pg-schema"].as<std::string>();
+        my->config->skip_to         = options.count("fill-skip-to") ? options["fill-skip-to"].as<uint32_t>() : 0;
+        my->config->stop_before     = options.count("fill-stop") ? options["fill-stop"].as<uint32_t>() : 0;
+        my->config->trx_filters     = compiled_trx_filter{fill_plugin::get_trx_filters(options)};
+        my->config->delta_filters   = fill_plugin::get_delta_filters(options);
+        my->config->drop_schema     = options.count("fpg-drop");
+        my->config->create_schema   = options.count("fpg-create");
+        my->config->compact_schema  = options.count("fpg-compact");
+        my->config->blob_store      = options.count("fpg-blob-store");
+        my->config->blob_min_size   = options["fpg-blob-min-size"].as<uint32_t>();
+        my->config->enable_trim     = options.count("fill-trim");
+        my->config->decode_threads  = options["fpg-decode-threads"].as<uint32_t>();
+        my->config->log_threads     = my->config->decode_threads;
+        my->config->pipeline_blocks = std::max(options["fpg-pipeline-blocks"].as<uint32_t>(), 1u);
+        my->config->pipeline_memory = uint64_t(options["fpg-pipeline-memory"].as<uint32_t>()) * 1024 * 1024;
+        my->config->commit          = fill_plugin::get_commit_policy(options);
+        my->config->trim_chunk      = options["fpg-trim-chunk"].as<uint32_t>();
+        my->config->partition_size  = options["fpg-partition-size"].as<uint32_t>();
+        my->config->defer_indexes   = options.count("fpg-defer-indexes");
+        my->config->index_distance  = options["fpg-index-distance"].as<uint32_t>();
+        my->config->index_threads   = options["fpg-index-threads"].as<uint32_t>();
+        my->config->backfill        = options["fpg-backfill"].as<uint32_t>();
+        my->config->current_tables  = options.count("fpg-current-tables");
+        my->config->checkpoints     = options.count("fpg-checkpoint") ? options["fpg-checkpoint"].as<std::vector<std::string>>() : std::vector<std::string>{};
+        my->config->checkpoint_step = options["fpg-checkpoint-interval"].as<uint32_t>();
+        if (!my->config->checkpoints.empty() && my->config->enable_trim)
+            throw std::runtime_error("--fpg-checkpoint needs the history --fill-trim removes");
+        if (my->config->backfill && !my->config->record_to.empty())
+            throw std::runtime_error("--fill-record records a single connection; it can't be used with --fpg-backfill");
+        if (my->config->backfill && !my->config->spool_dir.empty())
+            throw std::runtime_error("--fill-spool-dir spools a single connection; it can't be used with --fpg-backfill");
+        my->config->metrics_address = options.count("fill-metrics-address") ? options["fill-metrics-address"].as<std::string>() : "";
+        if (auto max_in_flight = options["fpg-max-in-flight"].as<uint32_t>())
+            my->config->max_messages_in_flight = max_in_flight;
     }
     FC_LOG_AND_RETHROW()
 }
 
-void fill_pg_plugin::plugin_startup() { my->start(); }
+void fill_pg_plugin::plugin_startup() {
+    if (!my->config->metrics_address.empty()) {
+        my->server = std::make_shared<metrics_server>(app().get_io_service(), my->metrics);
+        my->server->listen(my->config->metrics_address);
+    }
+    my->start();
+}
 
 void fill_pg_plugin::plugin_shutdown() {
     if (my->session)
         my->session->connection->close(false);
+    auto segment_sessions = std::move(my->segment_sessions);
+    my->segment_sessions.clear();
+    for (auto& [_, s] : segment_sessions)
+        if (s)
+            s->connection->close(false);
     my->timer.cancel();
+    if (my->server)
+        my->server->close();
     ilog("fill_pg_plugin stopped");
 }
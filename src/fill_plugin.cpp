@@ -1,6 +1,7 @@
 // copyright defined in LICENSE.txt
 
 #include "fill_plugin.hpp"
+#include "state_history_spool.hpp"
 #include "util.hpp"
 #include <eosio/ship_protocol.hpp>
 
@@ -19,13 +20,35 @@ void fill_plugin::set_program_options(options_description& cli, options_descript
     auto op   = cfg.add_options();
     auto clop = cli.add_options();
     op("fill-connect-to,f", bpo::value<std::string>()->default_value("127.0.0.1:8080"), "State-history endpoint to connect to (nodeos)");
+    op("fill-log-dir", bpo::value<std::string>(), "Read nodeos's state-history logs (trace_history.log, chain_state_history.log) in [arg] instead of connecting to nodeos");
+    op("fill-log-abi", bpo::value<std::string>(), "With --fill-log-dir, file holding the state-history abi nodeos sends");
+    op("fill-record", bpo::value<std::string>(), "Append the messages received from nodeos to the recording [arg], which ship-replay can serve");
+    op("fill-spool-dir", bpo::value<std::string>(), "Spool blocks received from nodeos in [arg] until they're committed, so a slow database doesn't stall the connection");
+    op("fill-spool-mb", bpo::value<uint32_t>()->default_value(4096), "Stop reading from nodeos while the spool uses more than [arg] MiB");
     op("fill-trim,t", "Trim history before irreversible");
     clop("fill-skip-to,k", bpo::value<uint32_t>(), "Skip blocks before [arg]");
     clop("fill-stop,x", bpo::value<uint32_t>(), "Stop before block [arg]");
     clop("fill-trx", bpo::value<std::vector<std::string>>(), "Filter transactions 'include:status:receiver:act_account:act_name'");
+    clop("fill-delta", bpo::value<std::vector<std::string>>(), "Filter table deltas 'include:delta:code:table:scope'");
+    clop("fill-commit-mb", bpo::value<uint32_t>()->default_value(64), "During catch-up, commit after buffering [arg] MiB");
+    clop("fill-commit-rows", bpo::value<uint64_t>()->default_value(1'000'000), "During catch-up, commit after buffering [arg] rows");
+    clop("fill-commit-ms", bpo::value<uint32_t>()->default_value(5000), "During catch-up, commit at least every [arg] ms");
+    clop("fill-near-head", bpo::value<uint32_t>()->default_value(4), "Commit every block within [arg] blocks of irreversible");
+    op("fill-metrics-address", bpo::value<std::string>(), "Serve prometheus metrics at http://[arg]/metrics, e.g. 127.0.0.1:9100");
 }
 
-void fill_plugin::plugin_initialize(const variables_map& options) {}
+void fill_plugin::plugin_initialize(const variables_map& options) {
+    try {
+        // The spool needs room for a segment being read and one being appended
+        auto min_spool_mb = 2 * state_history::spool_segment_size / (1024 * 1024);
+        if (options.count("fill-spool-dir") && options["fill-spool-mb"].as<uint32_t>() < min_spool_mb)
+            throw std::runtime_error("--fill-spool-mb must be at least " + std::to_string(min_spool_mb));
+        // The recorder records messages from nodeos; the log reader doesn't receive any
+        if (options.count("fill-record") && options.count("fill-log-dir"))
+            throw std::runtime_error("--fill-record records a connection to nodeos; it can't be used with --fill-log-dir");
+    }
+    FC_LOG_AND_RETHROW()
+}
 void fill_plugin::plugin_startup() {}
 void fill_plugin::plugin_shutdown() {}
 
@@ -66,3 +89,52 @@ std::vector<state_history::trx_filter> fill_plugin::get_trx_filters(const variab
         throw std::runtime_error("--fill-trx: "s + e.what());
     }
 }
+
+std::vector<state_history::delta_filter> fill_plugin::get_delta_filters(const variables_map& options) {
+    try {
+        std::vector<state_history::delta_filter> result;
+        if (!options.count("fill-delta"))
+            result.push_back({true});
+        else {
+            auto v = options["fill-delta"].as<std::vector<std::string>>();
+            for (auto& s : v) {
+                boost::erase_all(s, " ");
+                std::vector<std::string> split;
+                boost::split(split, s, [](char c) { return c == ':'; });
+
+                state_history::delta_filter filt;
+                if (split.size() > 0 && split[0] == "+")
+                    filt.include = true;
+                else if (split.size() > 0 && split[0] == "-")
+                    filt.include = false;
+                else
+                    throw std::runtime_error("include must be '+' or '-'");
+
+                if (split.size() > 1 && !split[1].empty())
+                    filt.delta = split[1];
+                if (split.size() > 2 && !split[2].empty())
+                    filt.code = abieos::name{split[2].c_str()};
+                if (split.size() > 3 && !split[3].empty())
+                    filt.table = abieos::name{split[3].c_str()};
+                if (split.size() > 4 && !split[4].empty())
+                    filt.scope = abieos::name{split[4].c_str()};
+                if ((filt.code || filt.table || filt.scope) && filt.delta && !state_history::is_contract_table(*filt.delta))
+                    throw std::runtime_error("only contract tables have code, table and scope");
+
+                result.push_back(filt);
+            }
+        }
+        return result;
+    } catch (std::exception& e) {
+        throw std::runtime_error("--fill-delta: "s + e.what());
+    }
+}
+
+state_history::commit_policy fill_plugin::get_commit_policy(const variables_map& options) {
+    state_history::commit_policy result;
+    result.max_bytes        = uint64_t(std::max(options["fill-commit-mb"].as<uint32_t>(), 1u)) * 1024 * 1024;
+    result.max_rows         = std::max(options["fill-commit-rows"].as<uint64_t>(), uint64_t(1));
+    result.max_time         = std::chrono::milliseconds{options["fill-commit-ms"].as<uint32_t>()};
+    result.near_head_blocks = options["fill-near-head"].as<uint32_t>();
+    return result;
+}
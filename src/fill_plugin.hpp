@@ -16,5 +16,7 @@ class fill_plugin : public appbase::plugin<fill_plugin> {
     void         plugin_startup();
     void         plugin_shutdown();
 
-    static std::vector<state_history::trx_filter> get_trx_filters(const appbase::variables_map& options);
+    static std::vector<state_history::trx_filter>   get_trx_filters(const appbase::variables_map& options);
+    static std::vector<state_history::delta_filter> get_delta_filters(const appbase::variables_map& options);
+    static state_history::commit_policy             get_commit_policy(const appbase::variables_map& options);
 };
@@ -2,6 +2,7 @@
 
 #include "fill_rocksdb_plugin.hpp"
 #include "state_history_connection.hpp"
+#include "state_history_metrics.hpp"
 #include "state_history_rocksdb.hpp"
 #include "util.hpp"
 
@@ -15,6 +16,9 @@ using namespace abieos;
 using namespace appbase;
 using namespace std::literals;
 using namespace state_history;
+using state_history::metrics::filler_metrics;
+using state_history::metrics::table_counters;
+using metrics_server = state_history::metrics::server;
 
 namespace asio      = boost::asio;
 namespace bpo       = boost::program_options;
@@ -44,20 +48,26 @@ struct rocksdb_table {
     const abieos::abi_type*                     abi_type  = {};
     std::vector<std::unique_ptr<rocksdb_field>> fields    = {};
     std::map<std::string, rocksdb_field*>       field_map = {};
+    table_counters*                             counters  = {};
 };
 
 struct fill_rocksdb_config : connection_config {
-    uint32_t                skip_to      = 0;
-    uint32_t                stop_before  = 0;
-    std::vector<trx_filter> trx_filters  = {};
-    bool                    enable_trim  = false;
-    bool                    enable_check = false;
+    uint32_t                  skip_to         = 0;
+    uint32_t                  stop_before     = 0;
+    compiled_trx_filter       trx_filters     = {};
+    std::vector<delta_filter> delta_filters   = {};
+    bool                      enable_trim     = false;
+    bool                      enable_check    = false;
+    commit_policy             commit          = {};
+    std::string               metrics_address = {};
 };
 
 struct fill_rocksdb_plugin_impl : std::enable_shared_from_this<fill_rocksdb_plugin_impl> {
     std::shared_ptr<fill_rocksdb_config> config = std::make_shared<fill_rocksdb_config>();
     std::shared_ptr<::flm_session>       session;
     boost::asio::deadline_timer          timer;
+    std::shared_ptr<filler_metrics>      metrics = std::make_shared<filler_metrics>("fill_rocksdb");
+    std::shared_ptr<metrics_server>      server;
 
     fill_rocksdb_plugin_impl()
         : timer(app().get_io_service()) {}
@@ -91,10 +101,14 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
     uint32_t                                   irreversible       = 0;
     abieos::checksum256                        irreversible_id    = {};
     uint32_t                                   first              = 0;
+    commit_batch                               batch              = {};
+    std::shared_ptr<filler_metrics>            metrics;
 
     flm_session(fill_rocksdb_plugin_impl* my)
         : my(my)
-        , config(my->config) {}
+        , config(my->config)
+        , batch{my->config->commit}
+        , metrics(my->metrics) {}
 
     void connect(asio::io_context& ioc) {
         connection = std::make_shared<state_history::connection>(ioc, *config, shared_from_this());
@@ -411,17 +425,24 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
     }
 
     void end_write(bool write_fill) {
+        state_history::metrics::timer timer(metrics->write);
         if (write_fill)
             write_fill_status(active_index_batch);
 
         // write content before indexes to enable truncate() to behave correctly if process exits before flushing
         write(rocksdb_inst->database, active_content_batch);
         write(rocksdb_inst->database, active_index_batch);
+        batch.clear();
+        if (write_fill && connection)
+            connection->committed(head);
     }
 
     bool received(get_blocks_result_v0& result) override {
         if (!result.this_block)
             return true;
+        metrics->receive_wait.observe(connection->read_wait);
+        metrics->chain_head.set(result.head.block_num);
+        metrics->chain_irreversible.set(result.last_irreversible.block_num);
         if (config->stop_before && result.this_block->block_num >= config->stop_before) {
             ilog("block ${b}: stop requested", ("b", result.this_block->block_num));
             end_write(true);
@@ -455,20 +476,23 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
                 end_write(true);
             }
 
-            bool near       = result.this_block->block_num + 4 >= result.last_irreversible.block_num;
-            bool commit_now = !(result.this_block->block_num % 200) || near;
-            if (commit_now)
-                ilog("block ${b}", ("b", result.this_block->block_num));
+            bool near         = config->commit.near_head(result.this_block->block_num, result.last_irreversible.block_num);
+            auto bytes_before = active_content_batch.GetDataSize() + active_index_batch.GetDataSize();
+            auto rows_before  = active_content_batch.Count();
 
             if (head_id != abieos::checksum256{} && (!result.prev_block || result.prev_block->block_id != head_id))
                 throw std::runtime_error("prev_block does not match");
-            if (result.block)
-                receive_block(
-                    result.this_block->block_num, result.this_block->block_id, *result.block, active_content_batch, active_index_batch);
-            if (result.deltas)
-                receive_deltas(active_content_batch, active_index_batch, result.this_block->block_num, *result.deltas);
-            if (result.traces)
-                receive_traces(active_content_batch, active_index_batch, result.this_block->block_num, *result.traces);
+            {
+                state_history::metrics::timer timer(metrics->decode);
+                if (result.block)
+                    receive_block(
+                        result.this_block->block_num, result.this_block->block_id, *result.block, active_content_batch,
+                        active_index_batch);
+                if (result.deltas)
+                    receive_deltas(active_content_batch, active_index_batch, result.this_block->block_num, *result.deltas);
+                if (result.traces)
+                    receive_traces(active_content_batch, active_index_batch, result.this_block->block_num, *result.traces);
+            }
 
             head            = result.this_block->block_num;
             head_id         = result.this_block->block_id;
@@ -481,13 +505,22 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
                 active_content_batch, kv::make_received_block_key(result.this_block->block_num),
                 kv::received_block{result.this_block->block_num, result.this_block->block_id});
 
-            if (commit_now) {
+            batch.add_block(
+                active_content_batch.GetDataSize() + active_index_batch.GetDataSize() - bytes_before,
+                active_content_batch.Count() - rows_before);
+            metrics->blocks.add();
+            metrics->head.set(head);
+            metrics->irreversible.set(irreversible);
+            if (near || batch.full()) {
+                ilog("block ${b}", ("b", result.this_block->block_num));
                 end_write(true);
                 if (config->enable_trim)
                     trim();
             }
-            if (near)
+            if (near) {
+                state_history::metrics::timer timer(metrics->commit);
                 rocksdb_inst->database.flush(false, false);
+            }
         } catch (...) {
             throw;
         }
@@ -540,6 +573,12 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
         kv::append_table_key(key, block_num, present_k, table.kv_table->short_name);
         kv::extract_keys(key, {value.data(), value.data() + value.size()}, table.kv_table->keys, positions);
         rdb::put(content_batch, key, value);
+        if (!table.counters)
+            table.counters = &metrics->table(table.name);
+        table.counters->rows.add();
+        table.counters->bytes.add(key.size() + value.size());
+        metrics->rows.add();
+        metrics->bytes.add(key.size() + value.size());
 
         std::vector<char> index_key;
         for (auto* index : table.kv_table->indexes) {
@@ -624,10 +663,16 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
             check_variant(bin, table_delta_type, "table_delta_v0");
             state_history::table_delta_v0 table_delta;
             bin_to_native(table_delta, bin);
-            auto& table = get_table(table_delta.name);
+            auto& table    = get_table(table_delta.name);
+            auto  filtered = filter_table(config->delta_filters, table_delta.name);
+            if (filtered == delta_filter_result::exclude)
+                continue;
 
             size_t num_processed = 0;
             for (auto& row : table_delta.rows) {
+                if (filtered == delta_filter_result::per_row &&
+                    !filter_row(config->delta_filters, table_delta.name, row.data.pos, row.data.end))
+                    continue;
                 if (table_delta.rows.size() > 10000 && !(num_processed % 10000)) {
                     ilog(
                         "block ${b} ${t} ${n} of ${r}",
@@ -850,24 +895,40 @@ void fill_rocksdb_plugin::plugin_initialize(const variables_map& options) {
         if (endpoint.find(':') == std::string::npos)
             throw std::runtime_error("invalid endpoint: " + endpoint);
 
-        auto port                = endpoint.substr(endpoint.find(':') + 1, endpoint.size());
-        auto host                = endpoint.substr(0, endpoint.find(':'));
-        my->config->host         = host;
-        my->config->port         = port;
-        my->config->skip_to      = options.count("fill-skip-to") ? options["fill-skip-to"].as<uint32_t>() : 0;
-        my->config->stop_before  = options.count("fill-stop") ? options["fill-stop"].as<uint32_t>() : 0;
-        my->config->trx_filters  = fill_plugin::get_trx_filters(options);
-        my->config->enable_trim  = options.count("fill-trim");
-        my->config->enable_check = options.count("frdb-check");
+        auto port                  = endpoint.substr(endpoint.find(':') + 1, endpoint.size());
+        auto host                  = endpoint.substr(0, endpoint.find(':'));
+        my->config->host            = host;
+        my->config->port            = port;
+        my->config->log_dir         = options.count("fill-log-dir") ? options["fill-log-dir"].as<std::string>() : "";
+        my->config->log_abi         = options.count("fill-log-abi") ? options["fill-log-abi"].as<std::string>() : "";
+        my->config->record_to       = options.count("fill-record") ? options["fill-record"].as<std::string>() : "";
+        my->config->spool_dir       = options.count("fill-spool-dir") ? options["fill-spool-dir"].as<std::string>() : "";
+        my->config->spool_max_bytes = uint64_t(options["fill-spool-mb"].as<uint32_t>()) * 1024 * 1024;
+        my->config->skip_to         = options.count("fill-skip-to") ? options["fill-skip-to"].as<uint32_t>() : 0;
+        my->config->stop_before     = options.count("fill-stop") ? options["fill-stop"].as<uint32_t>() : 0;
+        my->config->trx_filters     = compiled_trx_filter{fill_plugin::get_trx_filters(options)};
+        my->config->delta_filters   = fill_plugin::get_delta_filters(options);
+        my->config->enable_trim     = options.count("fill-trim");
+        my->config->enable_check    = options.count("frdb-check");
+        my->config->commit          = fill_plugin::get_commit_policy(options);
+        my->config->metrics_address = options.count("fill-metrics-address") ? options["fill-metrics-address"].as<std::string>() : "";
     }
     FC_LOG_AND_RETHROW()
 }
 
-void fill_rocksdb_plugin::plugin_startup() { my->start(); }
+void fill_rocksdb_plugin::plugin_startup() {
+    if (!my->config->metrics_address.empty()) {
+        my->server = std::make_shared<metrics_server>(app().get_io_service(), my->metrics);
+        my->server->listen(my->config->metrics_address);
+    }
+    my->start();
+}
 
 void fill_rocksdb_plugin::plugin_shutdown() {
     if (my->session)
         my->session->connection->close(false);
     my->timer.cancel();
+    if (my->server)
+        my->server->close();
     ilog("fill_rocksdb_plugin stopped");
 }
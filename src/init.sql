@@ -28,12 +28,34 @@
             "present" desc
         );
 
+        do $$
+            begin
+                if to_regclass('chain.account_checkpoint') is not null then
+                    create index if not exists account_name_block_present_cp on chain.account_checkpoint(
+                        "checkpoint_block",
+                        "name"
+                    );
+                end if;
+            end
+        $$;
+
         create index if not exists acctmeta_name_block_present_idx on chain.account_metadata(
             "name",
             "block_num" desc,
             "present" desc
         );
 
+        do $$
+            begin
+                if to_regclass('chain.account_metadata_checkpoint') is not null then
+                    create index if not exists acctmeta_name_block_present_cp on chain.account_metadata_checkpoint(
+                        "checkpoint_block",
+                        "name"
+                    );
+                end if;
+            end
+        $$;
+
         create index if not exists code_type_ver_hash_block_present_idx on chain.code(
             "vm_type",
             "vm_version",
@@ -42,6 +64,19 @@
             "present" desc
         );
 
+        do $$
+            begin
+                if to_regclass('chain.code_checkpoint') is not null then
+                    create index if not exists code_type_ver_hash_block_present_cp on chain.code_checkpoint(
+                        "checkpoint_block",
+                        "vm_type",
+                        "vm_version",
+                        "code_hash"
+                    );
+                end if;
+            end
+        $$;
+
         create index if not exists contract_row_code_table_primary_key_scope_block_num_prese_idx on chain.contract_row(
             "code",
             "table",
@@ -51,6 +86,20 @@
             "present" desc
         );
 
+        do $$
+            begin
+                if to_regclass('chain.contract_row_checkpoint') is not null then
+                    create index if not exists contract_row_code_table_primary_key_scope_block_num_prese_cp on chain.contract_row_checkpoint(
+                        "checkpoint_block",
+                        "code",
+                        "table",
+                        "primary_key",
+                        "scope"
+                    );
+                end if;
+            end
+        $$;
+
         create index if not exists contract_row_code_table_scope_primary_key_block_num_prese_idx on chain.contract_row(
             "code",
             "table",
@@ -60,6 +109,20 @@
             "present" desc
         );
 
+        do $$
+            begin
+                if to_regclass('chain.contract_row_checkpoint') is not null then
+                    create index if not exists contract_row_code_table_scope_primary_key_block_num_prese_cp on chain.contract_row_checkpoint(
+                        "checkpoint_block",
+                        "code",
+                        "table",
+                        "scope",
+                        "primary_key"
+                    );
+                end if;
+            end
+        $$;
+
         create index if not exists contract_row_scope_table_primary_key_code_block_num_prese_idx on chain.contract_row(
             "scope",
             "table",
@@ -69,6 +132,20 @@
             "present" desc
         );
 
+        do $$
+            begin
+                if to_regclass('chain.contract_row_checkpoint') is not null then
+                    create index if not exists contract_row_scope_table_primary_key_code_block_num_prese_cp on chain.contract_row_checkpoint(
+                        "checkpoint_block",
+                        "scope",
+                        "table",
+                        "primary_key",
+                        "code"
+                    );
+                end if;
+            end
+        $$;
+
         create index if not exists contract_index64_code_table_scope_sk_pk_block_num_prese_idx on chain.contract_index64(
             "code",
             "table",
@@ -79,6 +156,21 @@
             "present" desc
         );
 
+        do $$
+            begin
+                if to_regclass('chain.contract_index64_checkpoint') is not null then
+                    create index if not exists contract_index64_code_table_scope_sk_pk_block_num_prese_cp on chain.contract_index64_checkpoint(
+                        "checkpoint_block",
+                        "code",
+                        "table",
+                        "scope",
+                        "secondary_key",
+                        "primary_key"
+                    );
+                end if;
+            end
+        $$;
+
 
         drop function if exists chain.block_info_range_index;
         create function chain.block_info_range_index(
@@ -276,11 +368,97 @@
                 found_key bool = false;
                 found_block bool = false;
                 found_join_block bool = false;
+                from_checkpoint bigint;
             begin
                 if max_results <= 0 then
                     return;
                 end if;
                 
+                if to_regclass('chain.state_checkpoint') is not null then
+                    select
+                        max(state_checkpoint.block_num)
+                    into
+                        from_checkpoint
+                    from
+                        chain.state_checkpoint
+                    where
+                        state_checkpoint.table_name = 'account'
+                        and state_checkpoint.block_num <= snapshot_block_num;
+                end if;
+                if from_checkpoint is not null then
+                    for block_search in
+                        select
+                            distinct on(versions."name")
+                            versions.*
+                        from (
+                            (select
+                                checkpoint."block_num",
+                                checkpoint."present",
+                                checkpoint."name",
+                                checkpoint."creation_date",
+                                checkpoint."abi"
+                            from
+                                chain.account_checkpoint as checkpoint
+                            where
+                                checkpoint.checkpoint_block = from_checkpoint
+                                and (checkpoint."name") >= ("first_name")
+                                and (checkpoint."name") <= ("last_name")
+                            order by
+                                checkpoint."name"
+                            limit max_results)
+                            union all
+                            (select
+                                distinct on(account."name")
+                                account."block_num",
+                                account."present",
+                                account."name",
+                                account."creation_date",
+                                account."abi"
+                            from
+                                chain.account
+                            where
+                                account.block_num > from_checkpoint
+                                and account.block_num <= snapshot_block_num
+                                and (account."name") >= ("first_name")
+                                and (account."name") <= ("last_name")
+                            order by
+                                account."name",
+                                account."block_num" desc,
+                                account."present" desc
+                            limit max_results)
+                        ) as versions
+                        order by
+                            versions."name",
+                            versions."block_num" desc,
+                            versions."present" desc
+                    loop
+                        if block_search.present then
+                            
+                            "block_num" = block_search."block_num";
+                            "present" = block_search."present";
+                            "name" = block_search."name";
+                            "creation_date" = block_search."creation_date";
+                            "abi" = block_search."abi";
+                            return next;
+    
+                        else
+                            "block_num" = block_search."block_num";
+                            "present" = false;
+                            "name" = block_search."name";
+                            "creation_date" = null::timestamp;
+                            "abi" = ''::bytea;
+                            
+                            return next;
+                        end if;
+                        num_results = num_results + 1;
+                        if num_results >= max_results then
+                            return;
+                        end if;
+                    end loop;
+                    return;
+                end if;
+    
+                
                 for key_search in
                     select
                         account."name"
@@ -437,11 +615,158 @@
                 found_key bool = false;
                 found_block bool = false;
                 found_join_block bool = false;
+                from_checkpoint bigint;
             begin
                 if max_results <= 0 then
                     return;
                 end if;
                 
+                if to_regclass('chain.state_checkpoint') is not null then
+                    select
+                        max(state_checkpoint.block_num)
+                    into
+                        from_checkpoint
+                    from
+                        chain.state_checkpoint
+                    where
+                        state_checkpoint.table_name = 'account_metadata'
+                        and state_checkpoint.block_num <= snapshot_block_num;
+                end if;
+                if from_checkpoint is not null then
+                    for block_search in
+                        select
+                            distinct on(versions."name")
+                            versions.*
+                        from (
+                            (select
+                                checkpoint."block_num",
+                                checkpoint."present",
+                                checkpoint."name",
+                                checkpoint."privileged",
+                                checkpoint."last_code_update",
+                                checkpoint."code_present",
+                                checkpoint."code_vm_type",
+                                checkpoint."code_vm_version",
+                                checkpoint."code_code_hash"
+                            from
+                                chain.account_metadata_checkpoint as checkpoint
+                            where
+                                checkpoint.checkpoint_block = from_checkpoint
+                                and (checkpoint."name") >= ("first_name")
+                                and (checkpoint."name") <= ("last_name")
+                            order by
+                                checkpoint."name"
+                            limit max_results)
+                            union all
+                            (select
+                                distinct on(account_metadata."name")
+                                account_metadata."block_num",
+                                account_metadata."present",
+                                account_metadata."name",
+                                account_metadata."privileged",
+                                account_metadata."last_code_update",
+                                account_metadata."code_present",
+                                account_metadata."code_vm_type",
+                                account_metadata."code_vm_version",
+                                account_metadata."code_code_hash"
+                            from
+                                chain.account_metadata
+                            where
+                                account_metadata.block_num > from_checkpoint
+                                and account_metadata.block_num <= snapshot_block_num
+                                and (account_metadata."name") >= ("first_name")
+                                and (account_metadata."name") <= ("last_name")
+                            order by
+                                account_metadata."name",
+                                account_metadata."block_num" desc,
+                                account_metadata."present" desc
+                            limit max_results)
+                        ) as versions
+                        order by
+                            versions."name",
+                            versions."block_num" desc,
+                            versions."present" desc
+                    loop
+                        if block_search.present then
+                            
+                            found_join_block = false;
+                            for join_block_search in
+                                select
+                                    account."block_num",
+                                    account."present",
+                                    account."creation_date",
+                                    account."abi"
+                                from
+                                    chain.account
+                                where
+                                    account."name" = block_search."name"
+                                    and account.block_num <= snapshot_block_num
+                                order by
+                                    account."name",
+                                    account."block_num" desc,
+                                    account."present" desc
+                                limit 1
+                            loop
+                                if join_block_search.present then
+                                    found_join_block = true;
+                                    "block_num" = block_search."block_num";
+                                    "present" = block_search."present";
+                                    "name" = block_search."name";
+                                    "privileged" = block_search."privileged";
+                                    "last_code_update" = block_search."last_code_update";
+                                    "code_present" = block_search."code_present";
+                                    "code_vm_type" = block_search."code_vm_type";
+                                    "code_vm_version" = block_search."code_vm_version";
+                                    "code_code_hash" = block_search."code_code_hash";
+                                    "account_block_num" = join_block_search."block_num";
+                                    "account_present" = join_block_search."present";
+                                    "account_creation_date" = join_block_search."creation_date";
+                                    "account_abi" = join_block_search."abi";
+                                    return next;
+                                end if;
+                            end loop;
+                            if not found_join_block then
+                                "block_num" = block_search."block_num";
+                                "present" = block_search."present";
+                                "name" = block_search."name";
+                                "privileged" = block_search."privileged";
+                                "last_code_update" = block_search."last_code_update";
+                                "code_present" = block_search."code_present";
+                                "code_vm_type" = block_search."code_vm_type";
+                                "code_vm_version" = block_search."code_vm_version";
+                                "code_code_hash" = block_search."code_code_hash";
+                                "account_block_num" = 0::bigint;
+                                "account_present" = false::bool;
+                                "account_creation_date" = null::timestamp;
+                                "account_abi" = ''::bytea;
+                                return next;
+                            end if;
+    
+                        else
+                            "block_num" = block_search."block_num";
+                            "present" = false;
+                            "name" = block_search."name";
+                            "privileged" = false::bool;
+                            "last_code_update" = null::timestamp;
+                            "code_present" = false::bool;
+                            "code_vm_type" = 0::smallint;
+                            "code_vm_version" = 0::smallint;
+                            "code_code_hash" = ''::varchar(64);
+                            "account_block_num" = 0::bigint;
+                            "account_present" = false::bool;
+                            "account_creation_date" = null::timestamp;
+                            "account_abi" = ''::bytea;
+                            return next;
+                        end if;
+                        num_results = num_results + 1;
+                        if num_results >= max_results then
+                            return;
+                        end if;
+                    end loop;
+                    return;
+                end if;
+    
+                
                 for key_search in
                     select
                         account_metadata."name"
@@ -722,11 +1047,107 @@
                 found_key bool = false;
                 found_block bool = false;
                 found_join_block bool = false;
+                from_checkpoint bigint;
             begin
                 if max_results <= 0 then
                     return;
                 end if;
                 
+                if to_regclass('chain.state_checkpoint') is not null then
+                    select
+                        max(state_checkpoint.block_num)
+                    into
+                        from_checkpoint
+                    from
+                        chain.state_checkpoint
+                    where
+                        state_checkpoint.table_name = 'code'
+                        and state_checkpoint.block_num <= snapshot_block_num;
+                end if;
+                if from_checkpoint is not null then
+                    for block_search in
+                        select
+                            distinct on(versions."vm_type", versions."vm_version", versions."code_hash")
+                            versions.*
+                        from (
+                            (select
+                                checkpoint."block_num",
+                                checkpoint."present",
+                                checkpoint."vm_type",
+                                checkpoint."vm_version",
+                                checkpoint."code_hash",
+                                checkpoint."code"
+                            from
+                                chain.code_checkpoint as checkpoint
+                            where
+                                checkpoint.checkpoint_block = from_checkpoint
+                                and (checkpoint."vm_type", checkpoint."vm_version", checkpoint."code_hash") >= ("first_vm_type", "first_vm_version", "first_code_hash")
+                                and (checkpoint."vm_type", checkpoint."vm_version", checkpoint."code_hash") <= ("last_vm_type", "last_vm_version", "last_code_hash")
+                            order by
+                                checkpoint."vm_type",
+                                checkpoint."vm_version",
+                                checkpoint."code_hash"
+                            limit max_results)
+                            union all
+                            (select
+                                distinct on(code."vm_type", code."vm_version", code."code_hash")
+                                code."block_num",
+                                code."present",
+                                code."vm_type",
+                                code."vm_version",
+                                code."code_hash",
+                                code."code"
+                            from
+                                chain.code
+                            where
+                                code.block_num > from_checkpoint
+                                and code.block_num <= snapshot_block_num
+                                and (code."vm_type", code."vm_version", code."code_hash") >= ("first_vm_type", "first_vm_version", "first_code_hash")
+                                and (code."vm_type", code."vm_version", code."code_hash") <= ("last_vm_type", "last_vm_version", "last_code_hash")
+                            order by
+                                code."vm_type",
+                                code."vm_version",
+                                code."code_hash",
+                                code."block_num" desc,
+                                code."present" desc
+                            limit max_results)
+                        ) as versions
+                        order by
+                            versions."vm_type",
+                            versions."vm_version",
+                            versions."code_hash",
+                            versions."block_num" desc,
+                            versions."present" desc
+                    loop
+                        if block_search.present then
+                            
+                            "block_num" = block_search."block_num";
+                            "present" = block_search."present";
+                            "vm_type" = block_search."vm_type";
+                            "vm_version" = block_search."vm_version";
+                            "code_hash" = block_search."code_hash";
+                            "code" = block_search."code";
+                            return next;
+    
+                        else
+                            "block_num" = block_search."block_num";
+                            "present" = false;
+                            "vm_type" = block_search."vm_type";
+                            "vm_version" = block_search."vm_version";
+                            "code_hash" = block_search."code_hash";
+                            "code" = ''::bytea;
+                            
+                            return next;
+                        end if;
+                        num_results = num_results + 1;
+                        if num_results >= max_results then
+                            return;
+                        end if;
+                    end loop;
+                    return;
+                end if;
+    
+                
                 for key_search in
                     select
                         code."vm_type",code."vm_version",code."code_hash"
@@ -905,42 +1326,201 @@
                 found_key bool = false;
                 found_block bool = false;
                 found_join_block bool = false;
+                from_checkpoint bigint;
             begin
                 if max_results <= 0 then
                     return;
                 end if;
                 
-                for key_search in
+                if to_regclass('chain.state_checkpoint') is not null then
                     select
-                        account_metadata."name"
+                        max(state_checkpoint.block_num)
+                    into
+                        from_checkpoint
                     from
-                        chain.account_metadata
+                        chain.state_checkpoint
                     where
-                        (account_metadata."name") >= ("first_name")
-                    order by
-                        account_metadata."name",
-                        account_metadata."block_num" desc,
-                        account_metadata."present" desc
-                    limit 1
-                loop
-                    if (key_search."name") > (last_name) then
-                        return;
-                    end if;
-                    found_key = true;
-                    found_block = false;
-                    first_name = key_search."name";
+                        state_checkpoint.table_name = 'account_metadata'
+                        and state_checkpoint.block_num <= snapshot_block_num;
+                end if;
+                if from_checkpoint is not null then
                     for block_search in
                         select
-                            *
-                        from
-                            chain.account_metadata
-                        where
-                            account_metadata."name" = key_search."name"
-                            and account_metadata.block_num <= snapshot_block_num
+                            distinct on(versions."name")
+                            versions.*
+                        from (
+                            (select
+                                checkpoint."block_num",
+                                checkpoint."present",
+                                checkpoint."name",
+                                checkpoint."privileged",
+                                checkpoint."last_code_update",
+                                checkpoint."code_present",
+                                checkpoint."code_vm_type",
+                                checkpoint."code_vm_version",
+                                checkpoint."code_code_hash"
+                            from
+                                chain.account_metadata_checkpoint as checkpoint
+                            where
+                                checkpoint.checkpoint_block = from_checkpoint
+                                and (checkpoint."name") >= ("first_name")
+                                and (checkpoint."name") <= ("last_name")
+                            order by
+                                checkpoint."name"
+                            limit max_results)
+                            union all
+                            (select
+                                distinct on(account_metadata."name")
+                                account_metadata."block_num",
+                                account_metadata."present",
+                                account_metadata."name",
+                                account_metadata."privileged",
+                                account_metadata."last_code_update",
+                                account_metadata."code_present",
+                                account_metadata."code_vm_type",
+                                account_metadata."code_vm_version",
+                                account_metadata."code_code_hash"
+                            from
+                                chain.account_metadata
+                            where
+                                account_metadata.block_num > from_checkpoint
+                                and account_metadata.block_num <= snapshot_block_num
+                                and (account_metadata."name") >= ("first_name")
+                                and (account_metadata."name") <= ("last_name")
+                            order by
+                                account_metadata."name",
+                                account_metadata."block_num" desc,
+                                account_metadata."present" desc
+                            limit max_results)
+                        ) as versions
                         order by
-                            account_metadata."name",
-                            account_metadata."block_num" desc,
-                            account_metadata."present" desc
+                            versions."name",
+                            versions."block_num" desc,
+                            versions."present" desc
+                    loop
+                        if block_search.present then
+                            
+                            found_join_block = false;
+                            for join_block_search in
+                                select
+                                    code."block_num",
+                                    code."present",
+                                    code."vm_type",
+                                    code."vm_version",
+                                    code."code_hash",
+                                    code."code"
+                                from
+                                    chain.code
+                                where
+                                    code."vm_type" = block_search."code_vm_type"
+                                    and code."vm_version" = block_search."code_vm_version"
+                                    and code."code_hash" = block_search."code_code_hash"
+                                    and code.block_num <= snapshot_block_num
+                                order by
+                                    code."vm_type",
+                                    code."vm_version",
+                                    code."code_hash",
+                                    code."block_num" desc,
+                                    code."present" desc
+                                limit 1
+                            loop
+                                if join_block_search.present then
+                                    found_join_block = true;
+                                    "block_num" = block_search."block_num";
+                                    "present" = block_search."present";
+                                    "name" = block_search."name";
+                                    "privileged" = block_search."privileged";
+                                    "last_code_update" = block_search."last_code_update";
+                                    "code_present" = block_search."code_present";
+                                    "code_vm_type" = block_search."code_vm_type";
+                                    "code_vm_version" = block_search."code_vm_version";
+                                    "code_code_hash" = block_search."code_code_hash";
+                                    "join_block_num" = join_block_search."block_num";
+                                    "join_present" = join_block_search."present";
+                                    "join_vm_type" = join_block_search."vm_type";
+                                    "join_vm_version" = join_block_search."vm_version";
+                                    "join_code_hash" = join_block_search."code_hash";
+                                    "join_code" = join_block_search."code";
+                                    return next;
+                                end if;
+                            end loop;
+                            if not found_join_block then
+                                "block_num" = block_search."block_num";
+                                "present" = block_search."present";
+                                "name" = block_search."name";
+                                "privileged" = block_search."privileged";
+                                "last_code_update" = block_search."last_code_update";
+                                "code_present" = block_search."code_present";
+                                "code_vm_type" = block_search."code_vm_type";
+                                "code_vm_version" = block_search."code_vm_version";
+                                "code_code_hash" = block_search."code_code_hash";
+                                "join_block_num" = 0::bigint;
+                                "join_present" = false::bool;
+                                "join_vm_type" = 0::smallint;
+                                "join_vm_version" = 0::smallint;
+                                "join_code_hash" = ''::varchar(64);
+                                "join_code" = ''::bytea;
+                                return next;
+                            end if;
+    
+                        else
+                            "block_num" = block_search."block_num";
+                            "present" = false;
+                            "name" = block_search."name";
+                            "privileged" = false::bool;
+                            "last_code_update" = null::timestamp;
+                            "code_present" = false::bool;
+                            "code_vm_type" = 0::smallint;
+                            "code_vm_version" = 0::smallint;
+                            "code_code_hash" = ''::varchar(64);
+                            "join_block_num" = 0::bigint;
+                            "join_present" = false::bool;
+                            "join_vm_type" = 0::smallint;
+                            "join_vm_version" = 0::smallint;
+                            "join_code_hash" = ''::varchar(64);
+                            "join_code" = ''::bytea;
+                            return next;
+                        end if;
+                        num_results = num_results + 1;
+                        if num_results >= max_results then
+                            return;
+                        end if;
+                    end loop;
+                    return;
+                end if;
+    
+                
+                for key_search in
+                    select
+                        account_metadata."name"
+                    from
+                        chain.account_metadata
+                    where
+                        (account_metadata."name") >= ("first_name")
+                    order by
+                        account_metadata."name",
+                        account_metadata."block_num" desc,
+                        account_metadata."present" desc
+                    limit 1
+                loop
+                    if (key_search."name") > (last_name) then
+                        return;
+                    end if;
+                    found_key = true;
+                    found_block = false;
+                    first_name = key_search."name";
+                    for block_search in
+                        select
+                            *
+                        from
+                            chain.account_metadata
+                        where
+                            account_metadata."name" = key_search."name"
+                            and account_metadata.block_num <= snapshot_block_num
+                        order by
+                            account_metadata."name",
+                            account_metadata."block_num" desc,
+                            account_metadata."present" desc
                         limit 1
                     loop
                         if block_search.present then
@@ -1220,11 +1800,118 @@
                 found_key bool = false;
                 found_block bool = false;
                 found_join_block bool = false;
+                from_checkpoint bigint;
             begin
                 if max_results <= 0 then
                     return;
                 end if;
                 
+                if to_regclass('chain.state_checkpoint') is not null then
+                    select
+                        max(state_checkpoint.block_num)
+                    into
+                        from_checkpoint
+                    from
+                        chain.state_checkpoint
+                    where
+                        state_checkpoint.table_name = 'contract_row'
+                        and state_checkpoint.block_num <= snapshot_block_num;
+                end if;
+                if from_checkpoint is not null then
+                    for block_search in
+                        select
+                            distinct on(versions."code", versions."table", versions."primary_key", versions."scope")
+                            versions.*
+                        from (
+                            (select
+                                checkpoint."block_num",
+                                checkpoint."present",
+                                checkpoint."code",
+                                checkpoint."scope",
+                                checkpoint."table",
+                                checkpoint."primary_key",
+                                checkpoint."payer",
+                                checkpoint."value"
+                            from
+                                chain.contract_row_checkpoint as checkpoint
+                            where
+                                checkpoint.checkpoint_block = from_checkpoint
+                                and (checkpoint."code", checkpoint."table", checkpoint."primary_key", checkpoint."scope") >= ("first_code", "first_table", "first_primary_key", "first_scope")
+                                and (checkpoint."code", checkpoint."table", checkpoint."primary_key", checkpoint."scope") <= ("last_code", "last_table", "last_primary_key", "last_scope")
+                            order by
+                                checkpoint."code",
+                                checkpoint."table",
+                                checkpoint."primary_key",
+                                checkpoint."scope"
+                            limit max_results)
+                            union all
+                            (select
+                                distinct on(contract_row."code", contract_row."table", contract_row."primary_key", contract_row."scope")
+                                contract_row."block_num",
+                                contract_row."present",
+                                contract_row."code",
+                                contract_row."scope",
+                                contract_row."table",
+                                contract_row."primary_key",
+                                contract_row."payer",
+                                contract_row."value"
+                            from
+                                chain.contract_row
+                            where
+                                contract_row.block_num > from_checkpoint
+                                and contract_row.block_num <= snapshot_block_num
+                                and (contract_row."code", contract_row."table", contract_row."primary_key", contract_row."scope") >= ("first_code", "first_table", "first_primary_key", "first_scope")
+                                and (contract_row."code", contract_row."table", contract_row."primary_key", contract_row."scope") <= ("last_code", "last_table", "last_primary_key", "last_scope")
+                            order by
+                                contract_row."code",
+                                contract_row."table",
+                                contract_row."primary_key",
+                                contract_row."scope",
+                                contract_row."block_num" desc,
+                                contract_row."present" desc
+                            limit max_results)
+                        ) as versions
+                        order by
+                            versions."code",
+                            versions."table",
+                            versions."primary_key",
+                            versions."scope",
+                            versions."block_num" desc,
+                            versions."present" desc
+                    loop
+                        if block_search.present then
+                            
+                            "block_num" = block_search."block_num";
+                            "present" = block_search."present";
+                            "code" = block_search."code";
+                            "scope" = block_search."scope";
+                            "table" = block_search."table";
+                            "primary_key" = block_search."primary_key";
+                            "payer" = block_search."payer";
+                            "value" = block_search."value";
+                            return next;
+    
+                        else
+                            "block_num" = block_search."block_num";
+                            "present" = false;
+                            "code" = block_search."code";
+                            "scope" = block_search."scope";
+                            "table" = block_search."table";
+                            "primary_key" = block_search."primary_key";
+                            "payer" = ''::varchar(13);
+                            "value" = ''::bytea;
+                            
+                            return next;
+                        end if;
+                        num_results = num_results + 1;
+                        if num_results >= max_results then
+                            return;
+                        end if;
+                    end loop;
+                    return;
+                end if;
+    
+                
                 for key_search in
                     select
                         contract_row."code",contract_row."table",contract_row."primary_key",contract_row."scope"
@@ -1429,11 +2116,118 @@
                 found_key bool = false;
                 found_block bool = false;
                 found_join_block bool = false;
+                from_checkpoint bigint;
             begin
                 if max_results <= 0 then
                     return;
                 end if;
                 
+                if to_regclass('chain.state_checkpoint') is not null then
+                    select
+                        max(state_checkpoint.block_num)
+                    into
+                        from_checkpoint
+                    from
+                        chain.state_checkpoint
+                    where
+                        state_checkpoint.table_name = 'contract_row'
+                        and state_checkpoint.block_num <= snapshot_block_num;
+                end if;
+                if from_checkpoint is not null then
+                    for block_search in
+                        select
+                            distinct on(versions."code", versions."table", versions."scope", versions."primary_key")
+                            versions.*
+                        from (
+                            (select
+                                checkpoint."block_num",
+                                checkpoint."present",
+                                checkpoint."code",
+                                checkpoint."scope",
+                                checkpoint."table",
+                                checkpoint."primary_key",
+                                checkpoint."payer",
+                                checkpoint."value"
+                            from
+                                chain.contract_row_checkpoint as checkpoint
+                            where
+                                checkpoint.checkpoint_block = from_checkpoint
+                                and (checkpoint."code", checkpoint."table", checkpoint."scope", checkpoint."primary_key") >= ("first_code", "first_table", "first_scope", "first_primary_key")
+                                and (checkpoint."code", checkpoint."table", checkpoint."scope", checkpoint."primary_key") <= ("last_code", "last_table", "last_scope", "last_primary_key")
+                            order by
+                                checkpoint."code",
+                                checkpoint."table",
+                                checkpoint."scope",
+                                checkpoint."primary_key"
+                            limit max_results)
+                            union all
+                            (select
+                                distinct on(contract_row."code", contract_row."table", contract_row."scope", contract_row."primary_key")
+                                contract_row."block_num",
+                                contract_row."present",
+                                contract_row."code",
+                                contract_row."scope",
+                                contract_row."table",
+                                contract_row."primary_key",
+                                contract_row."payer",
+                                contract_row."value"
+                            from
+                                chain.contract_row
+                            where
+                                contract_row.block_num > from_checkpoint
+                                and contract_row.block_num <= snapshot_block_num
+                                and (contract_row."code", contract_row."table", contract_row."scope", contract_row."primary_key") >= ("first_code", "first_table", "first_scope", "first_primary_key")
+                                and (contract_row."code", contract_row."table", contract_row."scope", contract_row."primary_key") <= ("last_code", "last_table", "last_scope", "last_primary_key")
+                            order by
+                                contract_row."code",
+                                contract_row."table",
+                                contract_row."scope",
+                                contract_row."primary_key",
+                                contract_row."block_num" desc,
+                                contract_row."present" desc
+                            limit max_results)
+                        ) as versions
+                        order by
+                            versions."code",
+                            versions."table",
+                            versions."scope",
+                            versions."primary_key",
+                            versions."block_num" desc,
+                            versions."present" desc
+                    loop
+                        if block_search.present then
+                            
+                            "block_num" = block_search."block_num";
+                            "present" = block_search."present";
+                            "code" = block_search."code";
+                            "scope" = block_search."scope";
+                            "table" = block_search."table";
+                            "primary_key" = block_search."primary_key";
+                            "payer" = block_search."payer";
+                            "value" = block_search."value";
+                            return next;
+    
+                        else
+                            "block_num" = block_search."block_num";
+                            "present" = false;
+                            "code" = block_search."code";
+                            "scope" = block_search."scope";
+                            "table" = block_search."table";
+                            "primary_key" = block_search."primary_key";
+                            "payer" = ''::varchar(13);
+                            "value" = ''::bytea;
+                            
+                            return next;
+                        end if;
+                        num_results = num_results + 1;
+                        if num_results >= max_results then
+                            return;
+                        end if;
+                    end loop;
+                    return;
+                end if;
+    
+                
                 for key_search in
                     select
                         contract_row."code",contract_row."table",contract_row."scope",contract_row."primary_key"
@@ -1638,11 +2432,118 @@
                 found_key bool = false;
                 found_block bool = false;
                 found_join_block bool = false;
+                from_checkpoint bigint;
             begin
                 if max_results <= 0 then
                     return;
                 end if;
                 
+                if to_regclass('chain.state_checkpoint') is not null then
+                    select
+                        max(state_checkpoint.block_num)
+                    into
+                        from_checkpoint
+                    from
+                        chain.state_checkpoint
+                    where
+                        state_checkpoint.table_name = 'contract_row'
+                        and state_checkpoint.block_num <= snapshot_block_num;
+                end if;
+                if from_checkpoint is not null then
+                    for block_search in
+                        select
+                            distinct on(versions."scope", versions."table", versions."primary_key", versions."code")
+                            versions.*
+                        from (
+                            (select
+                                checkpoint."block_num",
+                                checkpoint."present",
+                                checkpoint."code",
+                                checkpoint."scope",
+                                checkpoint."table",
+                                checkpoint."primary_key",
+                                checkpoint."payer",
+                                checkpoint."value"
+                            from
+                                chain.contract_row_checkpoint as checkpoint
+                            where
+                                checkpoint.checkpoint_block = from_checkpoint
+                                and (checkpoint."scope", checkpoint."table", checkpoint."primary_key", checkpoint."code") >= ("first_scope", "first_table", "first_primary_key", "first_code")
+                                and (checkpoint."scope", checkpoint."table", checkpoint."primary_key", checkpoint."code") <= ("last_scope", "last_table", "last_primary_key", "last_code")
+                            order by
+                                checkpoint."scope",
+                                checkpoint."table",
+                                checkpoint."primary_key",
+                                checkpoint."code"
+                            limit max_results)
+                            union all
+                            (select
+                                distinct on(contract_row."scope", contract_row."table", contract_row."primary_key", contract_row."code")
+                                contract_row."block_num",
+                                contract_row."present",
+                                contract_row."code",
+                                contract_row."scope",
+                                contract_row."table",
+                                contract_row."primary_key",
+                                contract_row."payer",
+                                contract_row."value"
+                            from
+                                chain.contract_row
+                            where
+                                contract_row.block_num > from_checkpoint
+                                and contract_row.block_num <= snapshot_block_num
+                                and (contract_row."scope", contract_row."table", contract_row."primary_key", contract_row."code") >= ("first_scope", "first_table", "first_primary_key", "first_code")
+                                and (contract_row."scope", contract_row."table", contract_row."primary_key", contract_row."code") <= ("last_scope", "last_table", "last_primary_key", "last_code")
+                            order by
+                                contract_row."scope",
+                                contract_row."table",
+                                contract_row."primary_key",
+                                contract_row."code",
+                                contract_row."block_num" desc,
+                                contract_row."present" desc
+                            limit max_results)
+                        ) as versions
+                        order by
+                            versions."scope",
+                            versions."table",
+                            versions."primary_key",
+                            versions."code",
+                            versions."block_num" desc,
+                            versions."present" desc
+                    loop
+                        if block_search.present then
+                            
+                            "block_num" = block_search."block_num";
+                            "present" = block_search."present";
+                            "code" = block_search."code";
+                            "scope" = block_search."scope";
+                            "table" = block_search."table";
+                            "primary_key" = block_search."primary_key";
+                            "payer" = block_search."payer";
+                            "value" = block_search."value";
+                            return next;
+    
+                        else
+                            "block_num" = block_search."block_num";
+                            "present" = false;
+                            "code" = block_search."code";
+                            "scope" = block_search."scope";
+                            "table" = block_search."table";
+                            "primary_key" = block_search."primary_key";
+                            "payer" = ''::varchar(13);
+                            "value" = ''::bytea;
+                            
+                            return next;
+                        end if;
+                        num_results = num_results + 1;
+                        if num_results >= max_results then
+                            return;
+                        end if;
+                    end loop;
+                    return;
+                end if;
+    
+                
                 for key_search in
                     select
                         contract_row."scope",contract_row."table",contract_row."primary_key",contract_row."code"
@@ -1849,11 +2750,171 @@
                 found_key bool = false;
                 found_block bool = false;
                 found_join_block bool = false;
+                from_checkpoint bigint;
             begin
                 if max_results <= 0 then
                     return;
                 end if;
                 
+                if to_regclass('chain.state_checkpoint') is not null then
+                    select
+                        max(state_checkpoint.block_num)
+                    into
+                        from_checkpoint
+                    from
+                        chain.state_checkpoint
+                    where
+                        state_checkpoint.table_name = 'contract_index64'
+                        and state_checkpoint.block_num <= snapshot_block_num;
+                end if;
+                if from_checkpoint is not null then
+                    for block_search in
+                        select
+                            distinct on(versions."code", versions."table", versions."scope", versions."secondary_key", versions."primary_key")
+                            versions.*
+                        from (
+                            (select
+                                checkpoint."block_num",
+                                checkpoint."present",
+                                checkpoint."code",
+                                checkpoint."scope",
+                                checkpoint."table",
+                                checkpoint."primary_key",
+                                checkpoint."payer",
+                                checkpoint."secondary_key"
+                            from
+                                chain.contract_index64_checkpoint as checkpoint
+                            where
+                                checkpoint.checkpoint_block = from_checkpoint
+                                and (checkpoint."code", checkpoint."table", checkpoint."scope", checkpoint."secondary_key", checkpoint."primary_key") >= ("first_code", "first_table", "first_scope", "first_secondary_key", "first_primary_key")
+                                and (checkpoint."code", checkpoint."table", checkpoint."scope", checkpoint."secondary_key", checkpoint."primary_key") <= ("last_code", "last_table", "last_scope", "last_secondary_key", "last_primary_key")
+                            order by
+                                checkpoint."code",
+                                checkpoint."table",
+                                checkpoint."scope",
+                                checkpoint."secondary_key",
+                                checkpoint."primary_key"
+                            limit max_results)
+                            union all
+                            (select
+                                distinct on(contract_index64."code", contract_index64."table", contract_index64."scope", contract_index64."secondary_key", contract_index64."primary_key")
+                                contract_index64."block_num",
+                                contract_index64."present",
+                                contract_index64."code",
+                                contract_index64."scope",
+                                contract_index64."table",
+                                contract_index64."primary_key",
+                                contract_index64."payer",
+                                contract_index64."secondary_key"
+                            from
+                                chain.contract_index64
+                            where
+                                contract_index64.block_num > from_checkpoint
+                                and contract_index64.block_num <= snapshot_block_num
+                                and (contract_index64."code", contract_index64."table", contract_index64."scope", contract_index64."secondary_key", contract_index64."primary_key") >= ("first_code", "first_table", "first_scope", "first_secondary_key", "first_primary_key")
+                                and (contract_index64."code", contract_index64."table", contract_index64."scope", contract_index64."secondary_key", contract_index64."primary_key") <= ("last_code", "last_table", "last_scope", "last_secondary_key", "last_primary_key")
+                            order by
+                                contract_index64."code",
+                                contract_index64."table",
+                                contract_index64."scope",
+                                contract_index64."secondary_key",
+                                contract_index64."primary_key",
+                                contract_index64."block_num" desc,
+                                contract_index64."present" desc
+                            limit max_results)
+                        ) as versions
+                        order by
+                            versions."code",
+                            versions."table",
+                            versions."scope",
+                            versions."secondary_key",
+                            versions."primary_key",
+                            versions."block_num" desc,
+                            versions."present" desc
+                    loop
+                        if block_search.present then
+                            
+                            found_join_block = false;
+                            for join_block_search in
+                                select
+                                    contract_row."block_num",
+                                    contract_row."present",
+                                    contract_row."payer",
+                                    contract_row."value"
+                                from
+                                    chain.contract_row
+                                where
+                                    contract_row."code" = block_search."code"
+                                    and contract_row."table" = substring(block_search."table" for 12)
+                                    and contract_row."scope" = block_search."scope"
+                                    and contract_row."primary_key" = block_search."primary_key"
+                                    and contract_row.block_num <= snapshot_block_num
+                                order by
+                                    contract_row."code",
+                                    contract_row."table",
+                                    contract_row."scope",
+                                    contract_row."primary_key",
+                                    contract_row."block_num" desc,
+                                    contract_row."present" desc
+                                limit 1
+                            loop
+                                if join_block_search.present then
+                                    found_join_block = true;
+                                    "block_num" = block_search."block_num";
+                                    "present" = block_search."present";
+                                    "code" = block_search."code";
+                                    "scope" = block_search."scope";
+                                    "table" = block_search."table";
+                                    "primary_key" = block_search."primary_key";
+                                    "payer" = block_search."payer";
+                                    "secondary_key" = block_search."secondary_key";
+                                    "row_block_num" = join_block_search."block_num";
+                                    "row_present" = join_block_search."present";
+                                    "row_payer" = join_block_search."payer";
+                                    "row_value" = join_block_search."value";
+                                    return next;
+                                end if;
+                            end loop;
+                            if not found_join_block then
+                                "block_num" = block_search."block_num";
+                                "present" = block_search."present";
+                                "code" = block_search."code";
+                                "scope" = block_search."scope";
+                                "table" = block_search."table";
+                                "primary_key" = block_search."primary_key";
+                                "payer" = block_search."payer";
+                                "secondary_key" = block_search."secondary_key";
+                                "row_block_num" = 0::bigint;
+                                "row_present" = false::bool;
+                                "row_payer" = ''::varchar(13);
+                                "row_value" = ''::bytea;
+                                return next;
+                            end if;
+    
+                        else
+                            "block_num" = block_search."block_num";
+                            "present" = false;
+                            "code" = block_search."code";
+                            "scope" = block_search."scope";
+                            "table" = block_search."table";
+                            "primary_key" = block_search."primary_key";
+                            "payer" = ''::varchar(13);
+                            "secondary_key" = 0::decimal;
+                            "row_block_num" = 0::bigint;
+                            "row_present" = false::bool;
+                            "row_payer" = ''::varchar(13);
+                            "row_value" = ''::bytea;
+                            return next;
+                        end if;
+                        num_results = num_results + 1;
+                        if num_results >= max_results then
+                            return;
+                        end if;
+                    end loop;
+                    return;
+                end if;
+    
+                
                 for key_search in
                     select
                         contract_index64."code",contract_index64."table",contract_index64."scope",contract_index64."secondary_key",contract_index64."primary_key"
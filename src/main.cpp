@@ -26,6 +26,10 @@
 #include "wasm_ql_rocksdb_plugin.hpp"
 #endif
 
+#ifdef INCLUDE_SHIP_REPLAY_PLUGIN
+#include "ship_replay_plugin.hpp"
+#endif
+
 using namespace appbase;
 
 namespace fc {
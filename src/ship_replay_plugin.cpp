@@ -0,0 +1,250 @@
+// copyright defined in LICENSE.txt
+
+// Serves a recording made with --fill-record over the state-history websocket protocol, so fillers can be
+// benchmarked without nodeos
+
+#include "ship_replay_plugin.hpp"
+#include "state_history_recording.hpp"
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/websocket.hpp>
+#include <fc/exception/exception.hpp>
+
+#include <algorithm>
+#include <deque>
+
+using namespace appbase;
+using namespace eosio::ship_protocol;
+using namespace state_history;
+using namespace std::literals;
+
+namespace asio      = boost::asio;
+namespace bpo       = boost::program_options;
+namespace websocket = boost::beast::websocket;
+
+using asio::ip::tcp;
+using boost::beast::flat_buffer;
+using boost::system::error_code;
+
+struct ship_replay_config {
+    std::string recording;
+    std::string host;
+    std::string port;
+    uint32_t    blocks_per_second = 0;
+};
+
+// One client. Answers status requests with the recorded status and streams the recorded blocks from the requested
+// start, honoring max_messages_in_flight and acks like nodeos.
+struct replay_session : std::enable_shared_from_this<replay_session> {
+    std::shared_ptr<ship_replay_config>   config;
+    std::shared_ptr<recording::reader>    reader;
+    websocket::stream<tcp::socket>        stream;
+    asio::steady_timer                    timer;
+    flat_buffer                           in_buffer;
+    std::deque<const recording::frame*>   outbox;
+    bool                                  writing   = false;
+    bool                                  waiting   = false;
+    bool                                  streaming = false;
+    size_t                                next      = 0;
+    uint32_t                              end_block = 0;
+    uint32_t                              allowed   = 0;
+    uint64_t                              sent      = 0;
+    std::chrono::steady_clock::time_point start_time;
+    std::chrono::steady_clock::time_point due;
+
+    replay_session(std::shared_ptr<ship_replay_config> config, std::shared_ptr<recording::reader> reader, tcp::socket socket)
+        : config(std::move(config))
+        , reader(std::move(reader))
+        , stream(std::move(socket))
+        , timer(stream.get_executor()) {}
+
+    void start() {
+        stream.async_accept([self = shared_from_this(), this](error_code ec) {
+            if (ec)
+                return fail(ec, "accept");
+            outbox.push_back(&*reader->abi);
+            write();
+            read();
+        });
+    }
+
+    void fail(error_code ec, const char* what) {
+        if (ec != websocket::error::closed && ec != asio::error::operation_aborted)
+            elog("${w}: ${m}", ("w", what)("m", ec.message()));
+        timer.cancel();
+    }
+
+    void read() {
+        stream.async_read(in_buffer, [self = shared_from_this(), this](error_code ec, size_t) {
+            if (ec)
+                return fail(ec, "read");
+            try {
+                auto                data = in_buffer.data();
+                eosio::input_stream bin{(const char*)data.data(), data.size()};
+                request             req;
+                from_bin(req, bin);
+                in_buffer.consume(in_buffer.size());
+                std::visit([&](auto& r) { received(r); }, req);
+            } catch (const std::exception& e) {
+                elog("bad request: ${e}", ("e", e.what()));
+                return stream.next_layer().close();
+            }
+            write();
+            read();
+        });
+    }
+
+    void received(const get_status_request_v0&) { outbox.push_back(&*reader->status); }
+
+    void received(const get_blocks_request_v0& req) {
+        // Recordings which span a fork or a reconnect aren't sorted, so this searches from the start
+        next = std::find_if(
+                   reader->blocks.begin(), reader->blocks.end(),
+                   [&](const recording::frame& f) { return f.block_num >= req.start_block_num; }) -
+               reader->blocks.begin();
+        end_block  = req.end_block_num;
+        allowed    = req.max_messages_in_flight;
+        streaming  = true;
+        sent       = 0;
+        start_time = due = std::chrono::steady_clock::now();
+        ilog("replay blocks from ${b}", ("b", req.start_block_num));
+    }
+
+    void received(const get_blocks_ack_request_v0& req) { allowed += req.num_messages; }
+
+    template <typename T>
+    void received(const T&) {
+        throw std::runtime_error("unsupported request");
+    }
+
+    // Returns the next block to send, or nullptr if it isn't due yet or the client hasn't acked enough
+    const recording::frame* next_block() {
+        if (!streaming || waiting)
+            return nullptr;
+        if (next >= reader->blocks.size() || reader->blocks[next].block_num >= end_block) {
+            streaming = false;
+            auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+            ilog("replayed ${n} blocks in ${s}s: ${r} blocks/s", ("n", sent)("s", secs)("r", secs > 0 ? sent / secs : 0.0));
+            return nullptr;
+        }
+        if (!allowed)
+            return nullptr;
+        if (config->blocks_per_second) {
+            auto now = std::chrono::steady_clock::now();
+            if (now < due) {
+                waiting = true;
+                timer.expires_at(due);
+                timer.async_wait([self = shared_from_this(), this](error_code ec) {
+                    waiting = false;
+                    if (!ec)
+                        write();
+                });
+                return nullptr;
+            }
+            due = std::max(due, now) + std::chrono::nanoseconds(1'000'000'000 / config->blocks_per_second);
+        }
+        --allowed;
+        ++sent;
+        return &reader->blocks[next++];
+    }
+
+    // Sends queued replies first, then blocks
+    void write() {
+        if (writing)
+            return;
+        const recording::frame* f = nullptr;
+        if (!outbox.empty()) {
+            f = outbox.front();
+            outbox.pop_front();
+        } else {
+            f = next_block();
+        }
+        if (!f)
+            return;
+        writing = true;
+        stream.text(f->kind == recording::abi_frame);
+        stream.async_write(asio::buffer(f->data, f->size), [self = shared_from_this(), this](error_code ec, size_t) {
+            writing = false;
+            if (ec)
+                return fail(ec, "write");
+            write();
+        });
+    }
+}; // replay_session
+
+struct ship_replay_plugin_impl {
+    std::shared_ptr<ship_replay_config> config = std::make_shared<ship_replay_config>();
+    std::shared_ptr<recording::reader>  reader;
+    std::unique_ptr<tcp::acceptor>      acceptor;
+
+    void accept() {
+        acceptor->async_accept([this](error_code ec, tcp::socket socket) {
+            if (ec) {
+                if (ec != asio::error::operation_aborted)
+                    elog("accept: ${m}", ("m", ec.message()));
+                return;
+            }
+            ilog("client connected");
+            std::make_shared<replay_session>(config, reader, std::move(socket))->start();
+            accept();
+        });
+    }
+};
+
+static abstract_plugin& _ship_replay_plugin = app().register_plugin<ship_replay_plugin>();
+
+ship_replay_plugin::ship_replay_plugin()
+    : my(std::make_shared<ship_replay_plugin_impl>()) {}
+
+ship_replay_plugin::~ship_replay_plugin() {}
+
+void ship_replay_plugin::set_program_options(options_description& cli, options_description& cfg) {
+    auto op   = cfg.add_options();
+    auto clop = cli.add_options();
+    op("replay-listen", bpo::value<std::string>()->default_value("127.0.0.1:8080"), "Endpoint to serve the recording on");
+    clop("replay-recording", bpo::value<std::string>(), "Recording made with --fill-record");
+    clop("replay-blocks-per-second", bpo::value<uint32_t>()->default_value(0), "Send at most [arg] blocks per second; 0 for full speed");
+}
+
+void ship_replay_plugin::plugin_initialize(const variables_map& options) {
+    try {
+        auto endpoint = options.at("replay-listen").as<std::string>();
+        if (endpoint.find(':') == std::string::npos)
+            throw std::runtime_error("invalid endpoint: " + endpoint);
+        if (!options.count("replay-recording"))
+            throw std::runtime_error("--replay-recording is required");
+
+        my->config->host              = endpoint.substr(0, endpoint.find(':'));
+        my->config->port              = endpoint.substr(endpoint.find(':') + 1, endpoint.size());
+        my->config->recording         = options["replay-recording"].as<std::string>();
+        my->config->blocks_per_second = options["replay-blocks-per-second"].as<uint32_t>();
+    }
+    FC_LOG_AND_RETHROW()
+}
+
+void ship_replay_plugin::plugin_startup() {
+    my->reader = std::make_shared<recording::reader>(my->config->recording);
+    if (my->reader->blocks.empty())
+        throw std::runtime_error(my->config->recording + " holds no blocks");
+    ilog("${f} holds blocks ${b} - ${e}",
+         ("f", my->config->recording)("b", my->reader->blocks.front().block_num)("e", my->reader->blocks.back().block_num));
+
+    tcp::endpoint endpoint{asio::ip::make_address(my->config->host), (unsigned short)std::stoul(my->config->port)};
+    my->acceptor = std::make_unique<tcp::acceptor>(app().get_io_service());
+    my->acceptor->open(endpoint.protocol());
+    my->acceptor->set_option(asio::socket_base::reuse_address(true));
+    my->acceptor->bind(endpoint);
+    my->acceptor->listen();
+    ilog("listening on ${h}:${p}", ("h", my->config->host)("p", my->config->port));
+    my->accept();
+}
+
+void ship_replay_plugin::plugin_shutdown() {
+    if (my->acceptor) {
+        error_code ec;
+        my->acceptor->close(ec);
+    }
+    ilog("ship_replay_plugin stopped");
+}
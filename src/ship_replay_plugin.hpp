@@ -0,0 +1,20 @@
+// copyright defined in LICENSE.txt
+
+#pragma once
+#include <appbase/application.hpp>
+
+class ship_replay_plugin : public appbase::plugin<ship_replay_plugin> {
+  public:
+    APPBASE_PLUGIN_REQUIRES()
+
+    ship_replay_plugin();
+    virtual ~ship_replay_plugin();
+
+    virtual void set_program_options(appbase::options_description& cli, appbase::options_description& cfg) override;
+    void         plugin_initialize(const appbase::variables_map& options);
+    void         plugin_startup();
+    void         plugin_shutdown();
+
+  private:
+    std::shared_ptr<struct ship_replay_plugin_impl> my;
+};
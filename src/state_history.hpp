@@ -2,7 +2,9 @@
 
 #pragma once
 #include "abieos.hpp"
+#include <chrono>
 #include <eosio/ship_protocol.hpp>
+#include <unordered_map>
 
 namespace eosio { namespace ship_protocol {
     enum class transaction_status : uint8_t;
@@ -81,6 +83,46 @@ inline void check_variant(eosio::input_stream& bin, const abieos::abi_type& type
         throw std::runtime_error("expected "s + expected + " got " + type.as_variant()->at(index).name);
 }
 
+// Targets which decide when a filler commits the batch of blocks it has buffered. Near head every block commits;
+// during catch-up a batch commits once it holds max_bytes or max_rows, or has been open for max_time.
+struct commit_policy {
+    uint64_t                  max_bytes        = 64 * 1024 * 1024;
+    uint64_t                  max_rows         = 1'000'000;
+    std::chrono::milliseconds max_time         = std::chrono::milliseconds{5000};
+    uint32_t                  near_head_blocks = 4;
+
+    bool near_head(uint32_t block_num, uint32_t last_irreversible) const {
+        return block_num + near_head_blocks >= last_irreversible;
+    }
+};
+
+// Batch a filler is building under a commit_policy
+struct commit_batch {
+    commit_policy                         policy = {};
+    uint64_t                              bytes  = 0;
+    uint64_t                              rows   = 0;
+    uint32_t                              blocks = 0;
+    std::chrono::steady_clock::time_point start  = {};
+
+    void add_block(uint64_t block_bytes, uint64_t block_rows) {
+        if (!blocks++)
+            start = std::chrono::steady_clock::now();
+        bytes += block_bytes;
+        rows += block_rows;
+    }
+
+    bool full() const {
+        return blocks && (bytes >= policy.max_bytes || rows >= policy.max_rows ||
+                          std::chrono::steady_clock::now() - start >= policy.max_time);
+    }
+
+    void clear() {
+        bytes  = 0;
+        rows   = 0;
+        blocks = 0;
+    }
+};
+
 struct trx_filter {
     bool                                                    include     = {};
     std::optional<eosio::ship_protocol::transaction_status> status      = {};
@@ -120,4 +162,134 @@ inline bool filter(const std::vector<trx_filter>& filters, const eosio::ship_pro
     return false;
 }
 
+// trx_filter rules indexed by receiver, act_account or act_name. Finds the same rule as checking the rules in order,
+// but only checks the rules which could match the action.
+struct compiled_trx_filter {
+    using rule_list = std::vector<uint32_t>;
+
+    std::vector<trx_filter>                 rules          = {};
+    std::unordered_map<uint64_t, rule_list> by_receiver    = {};
+    std::unordered_map<uint64_t, rule_list> by_act_account = {};
+    std::unordered_map<uint64_t, rule_list> by_act_name    = {};
+    rule_list                               unkeyed        = {};
+
+    compiled_trx_filter() = default;
+
+    explicit compiled_trx_filter(std::vector<trx_filter> filters)
+        : rules(std::move(filters)) {
+        for (uint32_t i = 0; i < rules.size(); ++i) {
+            auto& rule = rules[i];
+            if (rule.receiver)
+                by_receiver[rule.receiver->value].push_back(i);
+            else if (rule.act_account)
+                by_act_account[rule.act_account->value].push_back(i);
+            else if (rule.act_name)
+                by_act_name[rule.act_name->value].push_back(i);
+            else
+                unkeyed.push_back(i);
+        }
+    }
+
+    // Returns the first rule which matches, or nullptr
+    const trx_filter* find(const eosio::ship_protocol::transaction_trace_v0& ttrace, const eosio::ship_protocol::action_trace& atrace) const {
+        uint64_t receiver    = std::visit([](auto&& arg) { return arg.receiver.value; }, atrace);
+        uint64_t act_account = std::visit([](auto&& arg) { return arg.act.account.value; }, atrace);
+        uint64_t act_name    = std::visit([](auto&& arg) { return arg.act.name.value; }, atrace);
+        uint32_t best        = rules.size();
+
+        // Each list is in rule order, so a search stops at its first match or at the best match so far
+        auto search = [&](const rule_list& list) {
+            for (auto i : list) {
+                if (i >= best)
+                    return;
+                auto& rule = rules[i];
+                if ((!rule.status || ttrace.status == *rule.status) && (!rule.receiver || rule.receiver->value == receiver) &&
+                    (!rule.act_account || rule.act_account->value == act_account) && (!rule.act_name || rule.act_name->value == act_name)) {
+                    best = i;
+                    return;
+                }
+            }
+        };
+        auto search_key = [&](const std::unordered_map<uint64_t, rule_list>& map, uint64_t key) {
+            auto it = map.find(key);
+            if (it != map.end())
+                search(it->second);
+        };
+
+        search(unkeyed);
+        search_key(by_receiver, receiver);
+        search_key(by_act_account, act_account);
+        search_key(by_act_name, act_name);
+        return best < rules.size() ? &rules[best] : nullptr;
+    }
+};
+
+inline bool filter(const compiled_trx_filter& filters, const eosio::ship_protocol::transaction_trace_v0& ttrace, const eosio::ship_protocol::action_trace& atrace) {
+    auto* rule = filters.find(ttrace, atrace);
+    return rule && rule->include;
+}
+
+inline bool filter(const compiled_trx_filter& filters, const eosio::ship_protocol::transaction_trace_v0& ttrace) {
+    for (auto& atrace : ttrace.action_traces)
+        if (filter(filters, ttrace, atrace))
+            return true;
+    return false;
+}
+
+// contract_table, contract_row and contract_index* rows start with code, scope and table
+inline bool is_contract_table(const std::string& name) { return !name.compare(0, 9, "contract_"); }
+
+struct delta_filter {
+    bool                        include = {};
+    std::optional<std::string>  delta   = {};
+    std::optional<abieos::name> code    = {};
+    std::optional<abieos::name> table   = {};
+    std::optional<abieos::name> scope   = {};
+};
+
+enum class delta_filter_result {
+    include,
+    exclude,
+    per_row,
+};
+
+// Decides what to do with a delta table's rows without looking at them when possible. per_row: the decision depends
+// on each row's code, table and scope.
+inline delta_filter_result filter_table(const std::vector<delta_filter>& filters, const std::string& name) {
+    for (auto& filt : filters) {
+        if (filt.delta && *filt.delta != name)
+            continue;
+        if (filt.code || filt.table || filt.scope) {
+            if (is_contract_table(name))
+                return delta_filter_result::per_row;
+            continue;
+        }
+        return filt.include ? delta_filter_result::include : delta_filter_result::exclude;
+    }
+    return delta_filter_result::exclude;
+}
+
+// Filters a contract table row using its serialized form, before it's decoded
+inline bool filter_row(const std::vector<delta_filter>& filters, const std::string& name, const char* pos, const char* end) {
+    eosio::input_stream bin{pos, end};
+    uint32_t            version;
+    uint64_t            code, scope, table;
+    eosio::varuint32_from_bin(version, bin);
+    eosio::from_bin(code, bin);
+    eosio::from_bin(scope, bin);
+    eosio::from_bin(table, bin);
+    for (auto& filt : filters) {
+        if (filt.delta && *filt.delta != name)
+            continue;
+        if (filt.code && filt.code->value != code)
+            continue;
+        if (filt.table && filt.table->value != table)
+            continue;
+        if (filt.scope && filt.scope->value != scope)
+            continue;
+        return filt.include;
+    }
+    return false;
+}
+
 } // namespace state_history
@@ -3,18 +3,76 @@
 #pragma once
 
 #include "state_history.hpp"
+#include "state_history_log.hpp"
+#include "state_history_recording.hpp"
+#include "state_history_spool.hpp"
 #include <eosio/check.hpp>
 #include <eosio/ship_protocol.hpp>
 #include <eosio/stream.hpp>
 
 #include <boost/asio/connect.hpp>
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/websocket.hpp>
 #include <fc/exception/exception.hpp>
 
+#include <deque>
+#include <mutex>
+
 namespace state_history {
 
+// Initial capacity of pooled receive buffers. They grow to fit larger messages and keep that capacity across blocks
+// and reconnects.
+static constexpr size_t receive_buffer_size = 4 * 1024 * 1024;
+
+// Recycles receive buffers. A buffer keeps the capacity it grew to, so large messages don't cause a new allocation
+// and page faults on every read. Buffers which grew past max_pooled_size_factor times initial_size are freed instead,
+// so a few huge messages don't pin memory for the rest of the process. Buffers return to the pool when the last
+// shared_ptr to them is released, which may happen on any thread.
+struct buffer_pool : std::enable_shared_from_this<buffer_pool> {
+    static constexpr size_t max_pooled_size_factor = 4;
+
+    using flat_buffer = boost::beast::flat_buffer;
+
+    std::mutex                                mutex;
+    std::vector<std::unique_ptr<flat_buffer>> buffers;
+    size_t                                    max_buffers  = 0;
+    size_t                                    initial_size = 0;
+
+    buffer_pool(size_t max_buffers, size_t initial_size)
+        : max_buffers(max_buffers)
+        , initial_size(initial_size) {}
+
+    std::shared_ptr<flat_buffer> get() {
+        std::unique_ptr<flat_buffer> buffer;
+        {
+            std::lock_guard lock(mutex);
+            if (!buffers.empty()) {
+                buffer = std::move(buffers.back());
+                buffers.pop_back();
+            }
+        }
+        if (buffer) {
+            buffer->consume(buffer->size());
+        } else {
+            buffer = std::make_unique<flat_buffer>();
+            buffer->prepare(initial_size);
+        }
+        return std::shared_ptr<flat_buffer>(buffer.release(), [pool = shared_from_this()](flat_buffer* b) { pool->put(b); });
+    }
+
+    void put(flat_buffer* b) {
+        std::unique_ptr<flat_buffer> buffer(b);
+        if (buffer->capacity() > max_pooled_size_factor * initial_size)
+            return;
+        std::lock_guard lock(mutex);
+        if (buffers.size() < max_buffers)
+            buffers.push_back(std::move(buffer));
+    }
+};
+
 struct connection_callbacks {
     virtual ~connection_callbacks() = default;
     virtual void received_abi(std::string_view abi) {}
@@ -27,6 +85,24 @@ struct connection_callbacks {
 struct connection_config {
     std::string host;
     std::string port;
+    uint32_t    max_messages_in_flight = 0xffff'ffff; // callers which lower this must call ack_blocks()
+    std::string log_dir;                              // if set, read nodeos's state-history logs instead of host:port
+    std::string log_abi;                              // with log_dir, file holding the abi nodeos sends
+    uint32_t    log_threads            = 2;           // with log_dir, threads which read ahead and inflate log entries
+    std::string record_to;                            // if set, append the messages received to this recording
+    std::string spool_dir;                            // if set, spool received blocks here until they're committed
+    uint64_t    spool_max_bytes        = 4ull * 1024 * 1024 * 1024;
+};
+
+// A block the connection reads from the state-history logs on its log pool. buffer holds the inflated traces and
+// deltas which result points into; done is set on the io thread once the read finished.
+struct log_block {
+    uint32_t                                   block_num = 0;
+    std::shared_ptr<boost::beast::flat_buffer> buffer    = {};
+    eosio::ship_protocol::get_blocks_result_v0 result    = {};
+    std::chrono::steady_clock::duration        read_time = {};
+    std::exception_ptr                         error     = {};
+    bool                                       done      = false;
 };
 
 struct connection : std::enable_shared_from_this<connection> {
@@ -48,6 +124,21 @@ struct connection : std::enable_shared_from_this<connection> {
     bool                                         have_abi  = false;
     abi_def                                      abi       = {};
     std::map<std::string, abi_type>              abi_types{};
+    std::shared_ptr<buffer_pool>                 buffers     = std::make_shared<buffer_pool>(2, receive_buffer_size);
+    std::shared_ptr<flat_buffer>                 frame       = {}; // message being delivered to callbacks
+    bool                                         reading     = false;
+    bool                                         read_paused = false;
+    std::chrono::steady_clock::time_point        read_start  = {};
+    std::chrono::steady_clock::duration          read_wait   = {}; // time the message being delivered spent on the socket
+    std::shared_ptr<state_history_logs>          logs        = {}; // set when reading log_dir
+    std::optional<boost::asio::thread_pool>      log_pool    = {};
+    std::deque<std::shared_ptr<log_block>>       log_blocks  = {}; // being read, in block order
+    uint32_t                                     log_next    = 0;  // next block to start reading
+    uint32_t                                     log_end     = 0;
+    uint64_t                                     log_request = 0;  // counts requests; reads for earlier ones are dropped
+    std::unique_ptr<recording::recorder>         recorder    = {};
+    std::unique_ptr<state_history::spool>        block_spool = {};
+    bool                                         delivering  = false;
 
     connection(boost::asio::io_context& ioc, const connection_config& config, std::shared_ptr<connection_callbacks> callbacks)
         : config(config)
@@ -60,6 +151,10 @@ struct connection : std::enable_shared_from_this<connection> {
     }
 
     void connect() {
+        if (!config.log_dir.empty()) {
+            catch_and_close([&] { open_logs(); });
+            return;
+        }
         ilog("connect to ${h}:${p}", ("h", config.host)("p", config.port));
         resolver.async_resolve(
             config.host, config.port, [self = shared_from_this(), this](error_code ec, tcp::resolver::results_type results) {
@@ -68,7 +163,14 @@ struct connection : std::enable_shared_from_this<connection> {
                         stream.next_layer(), results.begin(), results.end(), [self = shared_from_this(), this](error_code ec, auto&) {
                             enter_callback(ec, "connect", [&] {
                                 stream.async_handshake(config.host, "/", [self = shared_from_this(), this](error_code ec) {
-                                    enter_callback(ec, "handshake", [&] { //
+                                    enter_callback(ec, "handshake", [&] {
+                                        if (!config.record_to.empty() && !recorder) {
+                                            ilog("record to ${f}", ("f", config.record_to));
+                                            recorder = std::make_unique<recording::recorder>(config.record_to);
+                                        }
+                                        if (!config.spool_dir.empty() && !block_spool)
+                                            block_spool = std::make_unique<state_history::spool>(
+                                                config.spool_dir, spool_segment_size, config.spool_max_bytes);
                                         start_read();
                                     });
                                 });
@@ -79,22 +181,261 @@ struct connection : std::enable_shared_from_this<connection> {
     }
 
     void start_read() {
-        auto in_buffer = std::make_shared<flat_buffer>();
+        if (logs)
+            return start_log_read();
+        reading        = true;
+        read_start     = std::chrono::steady_clock::now();
+        auto in_buffer = buffers->get();
         stream.async_read(*in_buffer, [self = shared_from_this(), this, in_buffer](error_code ec, size_t) {
+            reading   = false;
+            read_wait = std::chrono::steady_clock::now() - read_start;
             enter_callback(ec, "async_read", [&] {
+                if (recorder) {
+                    auto data = in_buffer->data();
+                    recorder->write(
+                        have_abi ? recording::result_frame : recording::abi_frame, (const char*)data.data(), data.size());
+                }
                 if (!have_abi)
                     receive_abi(in_buffer);
                 else {
-                    if (!receive_result(in_buffer)) {
+                    if (!(block_spool ? spool_result(in_buffer) : receive_result(in_buffer))) {
                         close(false);
                         return;
                     }
                 }
-                start_read();
+                if (!intake_paused() && !reading)
+                    start_read();
+            });
+        });
+    }
+
+    // With a spool, reading from the socket only stops while the spool is full; callbacks pause delivery instead
+    bool intake_paused() { return block_spool ? block_spool->full() : read_paused; }
+
+    // Appends block results to the spool. Other results go straight to the callbacks.
+    bool spool_result(const std::shared_ptr<flat_buffer>& p) {
+        auto                         data = p->data();
+        input_buffer                 bin{(const char*)data.data(), (const char*)data.data() + data.size()};
+        eosio::ship_protocol::result result;
+        from_bin(result, bin);
+        uint32_t block_num = 0;
+        std::visit(
+            [&](auto& r) {
+                if constexpr (!std::is_same_v<std::decay_t<decltype(r)>, eosio::ship_protocol::get_status_result_v0>)
+                    if (r.this_block)
+                        block_num = r.this_block->block_num;
+            },
+            result);
+        if (!block_num)
+            return receive_result(p);
+        block_spool->append(block_num, (const char*)data.data(), data.size());
+        start_delivery();
+        return true;
+    }
+
+    // Hands spooled results to the callbacks one at a time until they pause reading or the spool runs dry
+    void start_delivery() {
+        if (delivering || read_paused || !callbacks)
+            return;
+        delivering = true;
+        boost::asio::post(stream.get_executor(), [self = shared_from_this(), this] {
+            delivering = false;
+            if (!callbacks)
+                return;
+            catch_and_close([&] {
+                const char* data;
+                uint32_t    size;
+                if (read_paused || !block_spool->peek(data, size))
+                    return;
+                auto buffer = buffers->get();
+                boost::asio::buffer_copy(buffer->prepare(size), boost::asio::buffer(data, size));
+                buffer->commit(size);
+                block_spool->next();
+                read_wait = {};
+                if (!receive_result(buffer)) {
+                    close(false);
+                    return;
+                }
+                start_delivery();
             });
         });
     }
 
+    // Resumes from the spool when it holds the requested start block, and that block follows the callbacks' position
+    // for the block before it. nodeos then only sends the blocks after the spool. Otherwise the spool is discarded.
+    void request_with_spool(eosio::ship_protocol::get_blocks_request_v0 req) {
+        std::optional<std::pair<size_t, size_t>>            resume;
+        std::vector<eosio::ship_protocol::block_position>   spooled;
+        std::optional<eosio::ship_protocol::block_position> prev;
+        for (auto& pos : req.have_positions)
+            if (pos.block_num + 1 == req.start_block_num)
+                prev = pos;
+        block_spool->seek(0, 0);
+        block_spool->for_each_unread([&](size_t seg, size_t offset, const char* data, uint32_t size, uint32_t block_num) {
+            input_buffer                 bin{data, data + size};
+            eosio::ship_protocol::result result;
+            from_bin(result, bin);
+            std::visit(
+                [&](auto& r) {
+                    if constexpr (!std::is_same_v<std::decay_t<decltype(r)>, eosio::ship_protocol::get_status_result_v0>) {
+                        if (block_num == req.start_block_num) {
+                            resume.reset();
+                            spooled.clear();
+                            if (!prev || (r.prev_block && r.prev_block->block_id == prev->block_id))
+                                resume.emplace(seg, offset);
+                        }
+                        if (resume) {
+                            while (!spooled.empty() && spooled.back().block_num >= block_num)
+                                spooled.pop_back();
+                            spooled.push_back(*r.this_block);
+                        }
+                    }
+                },
+                result);
+        });
+        if (resume) {
+            ilog("resume from spool at block ${b}; spool holds blocks up to ${e}",
+                 ("b", req.start_block_num)("e", spooled.back().block_num));
+            block_spool->seek(resume->first, resume->second);
+            block_spool->release(req.start_block_num - 1);
+            req.start_block_num = spooled.back().block_num + 1;
+            req.have_positions.insert(req.have_positions.end(), spooled.begin(), spooled.end());
+        } else {
+            block_spool->clear();
+        }
+        req.max_messages_in_flight = 0xffff'ffff;
+        write_request(req);
+        start_delivery();
+    }
+
+    // Tells the spool the callbacks committed the blocks up to block_num, so it can delete them. Must run on the io
+    // thread.
+    void committed(uint32_t block_num) {
+        if (!block_spool)
+            return;
+        block_spool->release(block_num);
+        if (have_abi && callbacks && !reading && !intake_paused())
+            start_read();
+    }
+
+    // Reads from nodeos's state-history logs instead of a socket. Requests are answered from the logs the way nodeos
+    // answers them, so callbacks can't tell the difference, except that blocks have no block field. Blocks are read
+    // and inflated on log_pool straight into receive buffers, which the callbacks get as frame.
+    void open_logs() {
+        ilog("read state-history logs in ${d}", ("d", config.log_dir));
+        if (config.log_abi.empty() || !boost::filesystem::exists(config.log_abi))
+            throw std::runtime_error("reading state-history logs needs the abi nodeos sends; missing: " + config.log_abi);
+        logs = std::make_shared<state_history_logs>(config.log_dir);
+        log_pool.emplace(std::max(config.log_threads, 1u));
+        ilog("state-history logs hold blocks ${b} - ${e}", ("b", logs->begin_block())("e", logs->end_block() - 1));
+        auto abi    = read_string(config.log_abi.c_str());
+        auto buffer = buffers->get();
+        boost::asio::buffer_copy(buffer->prepare(abi.size()), boost::asio::buffer(abi));
+        buffer->commit(abi.size());
+        receive_abi(buffer);
+    }
+
+    // Keeps two blocks per log thread reading ahead, and hands finished blocks to the callbacks in order
+    void start_log_read() {
+        while (log_blocks.size() < 2 * std::max(config.log_threads, 1u) && log_next < log_end)
+            read_log_block(log_next++);
+        if (reading || log_blocks.empty() || !log_blocks.front()->done)
+            return;
+        reading = true;
+        boost::asio::post(stream.get_executor(), [self = shared_from_this(), this] {
+            reading = false;
+            if (!callbacks || read_paused || log_blocks.empty() || !log_blocks.front()->done)
+                return;
+            catch_and_close([&] {
+                auto block = std::move(log_blocks.front());
+                log_blocks.pop_front();
+                if (block->error)
+                    std::rethrow_exception(block->error);
+                if (block->block_num + 1 == logs->end_block())
+                    ilog("reached the end of the state-history logs");
+                read_wait = block->read_time;
+                frame     = block->buffer;
+                bool ok   = callbacks->received(block->result);
+                frame.reset();
+                if (!ok) {
+                    close(false);
+                    return;
+                }
+                if (!read_paused)
+                    start_read();
+            });
+        });
+    }
+
+    // Reads and inflates the block on log_pool. The io thread owns block again once done is set.
+    void read_log_block(uint32_t block_num) {
+        auto block       = std::make_shared<log_block>();
+        block->block_num = block_num;
+        block->buffer    = buffers->get();
+        log_blocks.push_back(block);
+        boost::asio::post(*log_pool, [self = shared_from_this(), this, block, request = log_request]() mutable {
+            auto start = std::chrono::steady_clock::now();
+            try {
+                logs->read(block->block_num, block->result, *block->buffer);
+            } catch (...) { block->error = std::current_exception(); }
+            block->read_time = std::chrono::steady_clock::now() - start;
+
+            // Moves self so the pool thread never holds the last reference; the pool can't be destroyed from within
+            auto executor = stream.get_executor();
+            boost::asio::post(executor, [self = std::move(self), this, block = std::move(block), request] {
+                if (request != log_request)
+                    return;
+                block->done = true;
+                if (callbacks && !read_paused)
+                    start_log_read();
+            });
+        });
+    }
+
+    void answer_from_logs(const eosio::ship_protocol::request& req) {
+        std::visit(
+            [&](auto& r) {
+                using T = std::decay_t<decltype(r)>;
+                if constexpr (std::is_same_v<T, eosio::ship_protocol::get_status_request_v0>) {
+                    boost::asio::post(stream.get_executor(), [self = shared_from_this(), this] {
+                        if (callbacks)
+                            catch_and_close([&] {
+                                auto status = logs->status();
+                                read_wait   = {};
+                                if (!callbacks->received(status))
+                                    close(false);
+                            });
+                    });
+                } else if constexpr (std::is_same_v<T, eosio::ship_protocol::get_blocks_request_v0>) {
+                    // Like nodeos, restart at the first position whose block the logs hold with a different id
+                    log_next = std::max(r.start_block_num, logs->begin_block());
+                    for (auto& pos : r.have_positions) {
+                        auto id = pos.block_num < log_next ? logs->block_id(pos.block_num) : std::nullopt;
+                        if (id && *id != pos.block_id)
+                            log_next = pos.block_num;
+                    }
+                    log_end = std::min(r.end_block_num, logs->end_block());
+                    log_blocks.clear();
+                    ++log_request;
+                    if (!read_paused)
+                        start_read();
+                }
+            },
+            req);
+    }
+
+    // Stops reading after the current message. Callbacks use this to apply backpressure.
+    void pause_read() { read_paused = true; }
+
+    // Must run on the io thread
+    void resume_read() {
+        read_paused = false;
+        if (block_spool)
+            start_delivery();
+        else if (!reading && callbacks)
+            start_read();
+    }
+
     void receive_abi(const std::shared_ptr<flat_buffer>& p) {
         auto data = p->data();
         auto sv   = std::string_view{(const char*)data.data(), data.size()};
@@ -118,14 +459,18 @@ struct connection : std::enable_shared_from_this<connection> {
         input_buffer                 bin{(const char*)data.data(), (const char*)data.data() + data.size()};
         eosio::ship_protocol::result result;
         from_bin(result, bin);
-        return callbacks && std::visit([&](auto& r) { return callbacks->received(r); }, result);
+        frame   = p;
+        bool ok = callbacks && std::visit([&](auto& r) { return callbacks->received(r); }, result);
+        frame.reset();
+        return ok;
     }
 
-    void request_blocks(uint32_t start_block_num, const std::vector<eosio::ship_protocol::block_position>& positions) {
+    void request_blocks(
+        uint32_t start_block_num, const std::vector<eosio::ship_protocol::block_position>& positions, uint32_t end_block_num = 0xffff'ffff) {
         eosio::ship_protocol::get_blocks_request_v0 req;
         req.start_block_num        = start_block_num;
-        req.end_block_num          = 0xffff'ffff;
-        req.max_messages_in_flight = 0xffff'ffff;
+        req.end_block_num          = end_block_num;
+        req.max_messages_in_flight = config.max_messages_in_flight;
         req.have_positions         = positions;
         req.irreversible_only      = false;
         req.fetch_block            = true;
@@ -134,7 +479,9 @@ struct connection : std::enable_shared_from_this<connection> {
         send(req);
     }
 
-    void request_blocks(const eosio::ship_protocol::get_status_result_v0& status, uint32_t start_block_num, const std::vector<eosio::ship_protocol::block_position>& positions) {
+    void request_blocks(
+        const eosio::ship_protocol::get_status_result_v0& status, uint32_t start_block_num,
+        const std::vector<eosio::ship_protocol::block_position>& positions, uint32_t end_block_num = 0xffff'ffff) {
         uint32_t nodeos_start = 0xffff'ffff;
         if (status.trace_begin_block < status.trace_end_block)
             nodeos_start = std::min(nodeos_start, status.trace_begin_block);
@@ -142,7 +489,13 @@ struct connection : std::enable_shared_from_this<connection> {
             nodeos_start = std::min(nodeos_start, status.chain_state_begin_block);
         if (nodeos_start == 0xffff'ffff)
             nodeos_start = 0;
-        request_blocks(std::max(start_block_num, nodeos_start), positions);
+        request_blocks(std::max(start_block_num, nodeos_start), positions, end_block_num);
+    }
+
+    // Allows nodeos to send num_messages more results
+    void ack_blocks(uint32_t num_messages) {
+        if (!block_spool)
+            send(eosio::ship_protocol::get_blocks_ack_request_v0{num_messages});
     }
 
     const abi_type& get_type(const std::string& name) {
@@ -153,6 +506,14 @@ struct connection : std::enable_shared_from_this<connection> {
     }
 
     void send(const eosio::ship_protocol::request& req) {
+        if (logs)
+            return answer_from_logs(req);
+        if (block_spool && std::holds_alternative<eosio::ship_protocol::get_blocks_request_v0>(req))
+            return request_with_spool(std::get<eosio::ship_protocol::get_blocks_request_v0>(req));
+        write_request(req);
+    }
+
+    void write_request(const eosio::ship_protocol::request& req) {
         auto bin = std::make_shared<std::vector<char>>();
         eosio::convert_to_bin(req, *bin);
         stream.async_write(boost::asio::buffer(*bin), [self = shared_from_this(), bin, this](error_code ec, size_t) {
@@ -0,0 +1,195 @@
+// copyright defined in LICENSE.txt
+
+#pragma once
+#include "util.hpp"
+#include <eosio/ship_protocol.hpp>
+
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+namespace state_history {
+
+// Reads one of nodeos's state-history logs (trace_history or chain_state_history) through a read-only memory map.
+//
+// <name>.log holds one entry per block: a 48-byte header (magic, block_id, payload_size), the payload, then the
+// entry's own position as a uint64. The payload is a uint32 size followed by that many zlib-compressed bytes.
+// <name>.index holds the position of each block's entry, starting with the log's first block.
+struct state_history_log {
+    static constexpr size_t header_size = 8 + 32 + 8;
+
+    std::string                          name;
+    boost::iostreams::mapped_file_source log;
+    boost::iostreams::mapped_file_source index;
+    uint32_t                             begin_block = 0;
+    uint32_t                             end_block   = 0;
+
+    state_history_log(const boost::filesystem::path& dir, const std::string& name)
+        : name(name) {
+        auto log_path   = dir / (name + ".log");
+        auto index_path = dir / (name + ".index");
+        if (!boost::filesystem::exists(index_path))
+            throw std::runtime_error("missing " + index_path.string());
+        if (!boost::filesystem::file_size(log_path) || !boost::filesystem::file_size(index_path))
+            return;
+        log.open(log_path.string());
+        index.open(index_path.string());
+        uint32_t num_blocks = index.size() / sizeof(uint64_t);
+        if (!num_blocks)
+            return;
+        begin_block = block_num(entry_at(position(0)));
+        end_block   = begin_block + num_blocks;
+    }
+
+    bool contains(uint32_t block) const { return block >= begin_block && block < end_block; }
+
+    uint64_t position(uint32_t i) const {
+        uint64_t pos;
+        memcpy(&pos, index.data() + i * sizeof(uint64_t), sizeof(pos));
+        return pos;
+    }
+
+    // Header of the entry at pos, after checking it fits in the log
+    const char* entry_at(uint64_t pos) const {
+        if (pos + header_size > log.size())
+            throw std::runtime_error(name + ".log: entry at " + std::to_string(pos) + " is past the end");
+        auto     header = log.data() + pos;
+        uint64_t magic;
+        memcpy(&magic, header, sizeof(magic));
+        if ((magic & 0xffff'ffff'0000'0000) != abieos::name{"ship"}.value)
+            throw std::runtime_error(name + ".log: bad magic at " + std::to_string(pos));
+        if (magic & 0xffff'ffff)
+            throw std::runtime_error(name + ".log: unsupported version or features at " + std::to_string(pos));
+        uint64_t payload_size;
+        memcpy(&payload_size, header + 8 + 32, sizeof(payload_size));
+        if (payload_size > log.size() - pos - header_size)
+            throw std::runtime_error(name + ".log: entry at " + std::to_string(pos) + " is truncated");
+        return header;
+    }
+
+    // The block number is the big-endian prefix of the block id
+    static uint32_t block_num(const char* header) {
+        auto id = (const unsigned char*)header + 8;
+        return (uint32_t(id[0]) << 24) | (uint32_t(id[1]) << 16) | (uint32_t(id[2]) << 8) | uint32_t(id[3]);
+    }
+
+    const char* entry(uint32_t block) const {
+        auto header = entry_at(position(block - begin_block));
+        if (block_num(header) != block)
+            throw std::runtime_error(name + ".index: entry for block " + std::to_string(block) + " holds another block");
+        return header;
+    }
+
+    eosio::checksum256 block_id(uint32_t block) const {
+        eosio::input_stream bin{entry(block) + 8, 32};
+        eosio::checksum256  id;
+        from_bin(id, bin);
+        return id;
+    }
+
+    // Inflates the block's payload and appends it to out
+    void read(uint32_t block, boost::beast::flat_buffer& out) const {
+        auto     header = entry(block);
+        uint64_t payload_size;
+        memcpy(&payload_size, header + 8 + 32, sizeof(payload_size));
+        uint32_t size;
+        if (payload_size < sizeof(size))
+            throw std::runtime_error(name + ".log: payload of block " + std::to_string(block) + " is truncated");
+        memcpy(&size, header + header_size, sizeof(size));
+        if (size > payload_size - sizeof(size))
+            throw std::runtime_error(name + ".log: payload of block " + std::to_string(block) + " is truncated");
+        if (size)
+            zlib_decompress({header + header_size + sizeof(size), size}, out);
+    }
+}; // state_history_log
+
+// The logs in a nodeos state-history directory. Each connection opens its own, so several can read disjoint block
+// ranges in parallel; the memory maps share the page cache. Reading doesn't modify it, so several threads can read
+// blocks at once.
+struct state_history_logs {
+    std::optional<state_history_log>     traces;
+    std::optional<state_history_log>     chain_state;
+    eosio::ship_protocol::block_position head;
+
+    state_history_logs(const std::string& dir) {
+        if (boost::filesystem::exists(boost::filesystem::path(dir) / "trace_history.log"))
+            traces.emplace(dir, "trace_history");
+        if (boost::filesystem::exists(boost::filesystem::path(dir) / "chain_state_history.log"))
+            chain_state.emplace(dir, "chain_state_history");
+        if (begin_block() >= end_block())
+            throw std::runtime_error("no state-history log entries in " + dir);
+        head = {end_block() - 1, *block_id(end_block() - 1)};
+    }
+
+    uint32_t begin_block() const {
+        uint32_t result = 0xffff'ffff;
+        if (traces && traces->begin_block < traces->end_block)
+            result = std::min(result, traces->begin_block);
+        if (chain_state && chain_state->begin_block < chain_state->end_block)
+            result = std::min(result, chain_state->begin_block);
+        return result;
+    }
+
+    uint32_t end_block() const {
+        uint32_t result = 0;
+        if (traces)
+            result = std::max(result, traces->end_block);
+        if (chain_state)
+            result = std::max(result, chain_state->end_block);
+        return result;
+    }
+
+    std::optional<eosio::checksum256> block_id(uint32_t block) const {
+        if (traces && traces->contains(block))
+            return traces->block_id(block);
+        if (chain_state && chain_state->contains(block))
+            return chain_state->block_id(block);
+        return {};
+    }
+
+    eosio::ship_protocol::get_status_result_v0 status() const {
+        eosio::ship_protocol::get_status_result_v0 result;
+        result.head              = head;
+        result.last_irreversible = head;
+        if (traces) {
+            result.trace_begin_block = traces->begin_block;
+            result.trace_end_block   = traces->end_block;
+        }
+        if (chain_state) {
+            result.chain_state_begin_block = chain_state->begin_block;
+            result.chain_state_end_block   = chain_state->end_block;
+        }
+        return result;
+    }
+
+    // Fills result for block. data receives the inflated payloads result points into. The logs don't hold blocks, so
+    // result.block stays empty.
+    void read(uint32_t block, eosio::ship_protocol::get_blocks_result_v0& result, boost::beast::flat_buffer& data) const {
+        auto id = block_id(block);
+        if (!id)
+            throw std::runtime_error("block " + std::to_string(block) + " is not in the state-history logs");
+        result.head              = head;
+        result.last_irreversible = head;
+        result.this_block        = eosio::ship_protocol::block_position{block, *id};
+        result.prev_block.reset();
+        if (auto prev_id = block_id(block - 1))
+            result.prev_block = eosio::ship_protocol::block_position{block - 1, *prev_id};
+        result.traces.reset();
+        result.deltas.reset();
+
+        // Appending may move data's contents, so result points into it once both are in
+        data.consume(data.size());
+        if (traces && traces->contains(block))
+            traces->read(block, data);
+        size_t traces_size = data.size();
+        if (chain_state && chain_state->contains(block))
+            chain_state->read(block, data);
+        auto begin = (const char*)data.data().data();
+        if (traces && traces->contains(block))
+            result.traces = eosio::input_stream{begin, traces_size};
+        if (chain_state && chain_state->contains(block))
+            result.deltas = eosio::input_stream{begin + traces_size, data.size() - traces_size};
+    }
+}; // state_history_logs
+
+} // namespace state_history
@@ -0,0 +1,235 @@
+// copyright defined in LICENSE.txt
+
+#pragma once
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <fc/log/logger.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace state_history {
+
+// Counters and histograms the fillers update from any thread, rendered in the prometheus text format
+namespace metrics {
+
+struct counter {
+    std::atomic<uint64_t> value = 0;
+
+    void add(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+};
+
+struct gauge {
+    std::atomic<int64_t> value = 0;
+
+    void set(int64_t v) { value.store(v, std::memory_order_relaxed); }
+};
+
+// Latency histogram with fixed buckets from 100us to 10s
+struct histogram {
+    static constexpr std::array<double, 11> bounds = {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.01, 0.05, 0.1, 0.5, 1, 10};
+
+    std::array<std::atomic<uint64_t>, bounds.size()> buckets    = {};
+    std::atomic<uint64_t>                            count      = 0;
+    std::atomic<uint64_t>                            sum_micros = 0;
+
+    void observe(std::chrono::steady_clock::duration d) {
+        auto   micros  = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+        double seconds = micros / 1'000'000.0;
+        for (size_t i = 0; i < bounds.size(); ++i) {
+            if (seconds <= bounds[i]) {
+                buckets[i].fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+        }
+        count.fetch_add(1, std::memory_order_relaxed);
+        sum_micros.fetch_add(micros, std::memory_order_relaxed);
+    }
+};
+
+// Times a scope into a histogram
+struct timer {
+    histogram&                            hist;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    timer(histogram& hist)
+        : hist(hist) {}
+    ~timer() { hist.observe(std::chrono::steady_clock::now() - start); }
+};
+
+struct table_counters {
+    counter rows;
+    counter bytes;
+};
+
+struct filler_metrics {
+    std::string name;
+    counter     blocks;
+    counter     rows;
+    counter     bytes;
+    histogram   receive_wait;
+    histogram   decode;
+    histogram   write;
+    histogram   commit;
+    gauge       head;
+    gauge       irreversible;
+    gauge       chain_head;
+    gauge       chain_irreversible;
+
+    std::mutex                                             tables_mutex;
+    std::map<std::string, std::unique_ptr<table_counters>> tables;
+
+    filler_metrics(std::string name)
+        : name(std::move(name)) {}
+
+    // The returned counters live as long as this object
+    table_counters& table(const std::string& table_name) {
+        std::lock_guard lock(tables_mutex);
+        auto&           t = tables[table_name];
+        if (!t)
+            t = std::make_unique<table_counters>();
+        return *t;
+    }
+
+    std::string render() {
+        std::string result;
+        auto        metric = [&](const std::string& metric_name, const char* type, const char* help) {
+            result += "# HELP " + name + "_" + metric_name + " " + help + "\n";
+            result += "# TYPE " + name + "_" + metric_name + " " + type + "\n";
+        };
+        auto value = [&](const std::string& metric_name, const std::string& labels, auto v) {
+            result += name + "_" + metric_name + (labels.empty() ? "" : "{" + labels + "}") + " " + std::to_string(v) + "\n";
+        };
+        auto counter_metric = [&](const std::string& metric_name, const char* help, counter& c) {
+            metric(metric_name, "counter", help);
+            value(metric_name, "", c.value.load());
+        };
+        auto gauge_metric = [&](const std::string& metric_name, const char* help, gauge& g) {
+            metric(metric_name, "gauge", help);
+            value(metric_name, "", g.value.load());
+        };
+        auto histogram_metric = [&](const std::string& metric_name, const char* help, histogram& h) {
+            metric(metric_name, "histogram", help);
+            uint64_t cumulative = 0;
+            for (size_t i = 0; i < histogram::bounds.size(); ++i) {
+                cumulative += h.buckets[i].load();
+                auto bound = std::to_string(histogram::bounds[i]);
+                bound.erase(bound.find_last_not_of('0') + 1);
+                if (bound.back() == '.')
+                    bound.pop_back();
+                value(metric_name + "_bucket", "le=\"" + bound + "\"", cumulative);
+            }
+            value(metric_name + "_bucket", "le=\"+Inf\"", h.count.load());
+            value(metric_name + "_sum", "", h.sum_micros.load() / 1'000'000.0);
+            value(metric_name + "_count", "", h.count.load());
+        };
+
+        counter_metric("blocks_total", "Blocks written", blocks);
+        counter_metric("rows_total", "Rows written", rows);
+        counter_metric("bytes_total", "Bytes of rows written", bytes);
+        histogram_metric("receive_wait_seconds", "Time waiting on the state-history socket for a message", receive_wait);
+        histogram_metric("decode_seconds", "Time decoding a block into rows", decode);
+        histogram_metric("write_seconds", "Time handing a block's rows to the database", write);
+        histogram_metric("commit_seconds", "Time committing", commit);
+        gauge_metric("head_block", "Last block written", head);
+        gauge_metric("irreversible_block", "Irreversible block as of the last block written", irreversible);
+        gauge_metric("chain_head_block", "Head block reported by nodeos", chain_head);
+        gauge_metric("chain_irreversible_block", "Irreversible block reported by nodeos", chain_irreversible);
+
+        std::lock_guard lock(tables_mutex);
+        metric("table_rows_total", "counter", "Rows written, by table");
+        for (auto& [table_name, t] : tables)
+            value("table_rows_total", "table=\"" + table_name + "\"", t->rows.value.load());
+        metric("table_bytes_total", "counter", "Bytes of rows written, by table");
+        for (auto& [table_name, t] : tables)
+            value("table_bytes_total", "table=\"" + table_name + "\"", t->bytes.value.load());
+        return result;
+    }
+};
+
+// Serves GET /metrics
+struct http_session : std::enable_shared_from_this<http_session> {
+    boost::asio::ip::tcp::socket                                   socket;
+    std::shared_ptr<filler_metrics>                                metrics;
+    boost::beast::flat_buffer                                      buffer;
+    boost::beast::http::request<boost::beast::http::empty_body>    request;
+    boost::beast::http::response<boost::beast::http::string_body> response;
+
+    http_session(boost::asio::ip::tcp::socket socket, std::shared_ptr<filler_metrics> metrics)
+        : socket(std::move(socket))
+        , metrics(std::move(metrics)) {}
+
+    void run() {
+        boost::beast::http::async_read(
+            socket, buffer, request, [self = shared_from_this(), this](boost::system::error_code ec, size_t) {
+                if (ec)
+                    return;
+                namespace http = boost::beast::http;
+                response.version(request.version());
+                response.keep_alive(false);
+                if (request.method() != http::verb::get || request.target() != "/metrics") {
+                    response.result(http::status::not_found);
+                    response.set(http::field::content_type, "text/plain");
+                    response.body() = "not found\n";
+                } else {
+                    response.result(http::status::ok);
+                    response.set(http::field::content_type, "text/plain; version=0.0.4");
+                    response.body() = metrics->render();
+                }
+                response.prepare_payload();
+                http::async_write(socket, response, [self, this](boost::system::error_code ec, size_t) {
+                    socket.shutdown(boost::asio::ip::tcp::socket::shutdown_send, ec);
+                });
+            });
+    }
+};
+
+struct server : std::enable_shared_from_this<server> {
+    boost::asio::ip::tcp::acceptor  acceptor;
+    std::shared_ptr<filler_metrics> metrics;
+
+    server(boost::asio::io_context& ioc, std::shared_ptr<filler_metrics> metrics)
+        : acceptor(ioc)
+        , metrics(std::move(metrics)) {}
+
+    // address: host:port
+    void listen(const std::string& address) {
+        auto pos = address.rfind(':');
+        if (pos == std::string::npos)
+            throw std::runtime_error("invalid metrics address: " + address);
+        boost::asio::ip::tcp::endpoint endpoint{
+            boost::asio::ip::make_address(address.substr(0, pos)), (unsigned short)std::stoul(address.substr(pos + 1))};
+        acceptor.open(endpoint.protocol());
+        acceptor.set_option(boost::asio::socket_base::reuse_address(true));
+        acceptor.bind(endpoint);
+        acceptor.listen();
+        ilog("metrics at http://${a}/metrics", ("a", address));
+        accept();
+    }
+
+    void close() {
+        boost::system::error_code ec;
+        acceptor.close(ec);
+    }
+
+    void accept() {
+        acceptor.async_accept([self = shared_from_this(), this](boost::system::error_code ec, boost::asio::ip::tcp::socket socket) {
+            if (ec) {
+                if (ec != boost::asio::error::operation_aborted)
+                    elog("metrics accept: ${m}", ("m", ec.message()));
+                return;
+            }
+            std::make_shared<http_session>(std::move(socket), metrics)->run();
+            accept();
+        });
+    }
+};
+
+} // namespace metrics
+} // namespace state_history
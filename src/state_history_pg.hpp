@@ -50,6 +50,18 @@ inline std::string quote(bool bulk, std::string s) {
 
 inline std::string quote(std::string s) { return quote(false, s); }
 
+// Quotes an identifier the same way pqxx's quote_name does for utf-8 names, without needing a connection. Code which
+// runs off the connection's thread uses this.
+inline std::string quote_name(const std::string& s) {
+    std::string result = "\"";
+    for (auto ch : s) {
+        if (ch == '"')
+            result += '"';
+        result += ch;
+    }
+    return result + "\"";
+}
+
 inline std::string quote_bytea(bool bulk, std::string s) {
     if (bulk)
         return "\\\\x" + s;
@@ -102,7 +114,10 @@ inline abieos::bytes sql_to_bytes(const char* ch) {
     return result;
 }
 
+// Accepts hex text, or bytea in postgresql's hex output format (compact profile)
 inline abieos::checksum256 sql_to_checksum256(const char* ch) {
+    if (ch[0] == '\\' && ch[1] == 'x')
+        ch += 2;
     if (!*ch)
         return {};
     std::vector<uint8_t> v;
@@ -119,6 +134,32 @@ inline abieos::checksum256 sql_to_checksum256(const char* ch) {
 template <typename T>
 std::string sql_str(pqxx::connection& c, bool bulk, const T& obj);
 
+// The compact schema profile (fill-pg --fpg-compact) stores checksum256 as 32 raw bytes of bytea instead of hex text,
+// and name as a bigint instead of text. The bigint is the name's value with the top bit flipped, so bigints sort in
+// the same order as names.
+struct compact_checksum256 {
+    eosio::checksum256 value = {};
+};
+
+struct compact_name {
+    eosio::name value = {};
+};
+
+inline compact_checksum256 compact_of(const eosio::checksum256& v) { return {v}; }
+inline compact_name        compact_of(eosio::name v) { return {v}; }
+
+inline constexpr uint64_t compact_name_flip = 0x8000'0000'0000'0000;
+
+inline int64_t     name_to_compact(eosio::name v) { return int64_t(v.value ^ compact_name_flip); }
+inline eosio::name compact_to_name(int64_t v) { return eosio::name{uint64_t(v) ^ compact_name_flip}; }
+
+// A checksum256 or name which sql_values() formats for the schema's profile
+template <typename T>
+struct profiled {
+    const T& value;
+    bool     compact;
+};
+
 inline std::string sql_str(pqxx::connection& c, bool bulk, const std::string& s) {
     try {
         std::string tmp = c.esc(s);
@@ -183,6 +224,8 @@ inline std::string sql_str(bool bulk, const eosio::signature& v)
 inline std::string sql_str(bool bulk, const eosio::bytes&)                              { throw std::runtime_error("sql_str(bytes): not implemented"); }
 inline std::string sql_str(bool bulk, eosio::ship_protocol::transaction_status v)       { return quote(bulk, to_string(v)); }
 inline std::string sql_str(bool bulk, eosio::symbol v)                                  { return quote(bulk, eosio::symbol_to_string(v.value)); }
+inline std::string sql_str(bool bulk, const compact_checksum256& v)                     { return quote_bytea(bulk, v.value.value == abieos::checksum256{}.value ? "" : abieos::hex(v.value.value.begin(), v.value.value.end())); }
+inline std::string sql_str(bool bulk, compact_name v)                                   { return std::to_string(name_to_compact(v.value)); }
 
 inline std::string sql_str(pqxx::connection&, bool bulk, bool v)                        { return sql_str(bulk, v); }
 inline std::string sql_str(pqxx::connection&, bool bulk, eosio::varuint32 v)            { return sql_str(bulk, v); }
@@ -200,8 +243,15 @@ inline std::string sql_str(pqxx::connection&, bool bulk, const eosio::signature&
 inline std::string sql_str(pqxx::connection&, bool bulk,
                            eosio::ship_protocol::transaction_status v)                  { return sql_str(bulk, v); }
 inline std::string sql_str(pqxx::connection&, bool bulk, eosio::symbol v)               { return sql_str(bulk, v); }
+inline std::string sql_str(pqxx::connection&, bool bulk, const compact_checksum256& v)  { return sql_str(bulk, v); }
+inline std::string sql_str(pqxx::connection&, bool bulk, compact_name v)                { return sql_str(bulk, v); }
 // clang-format on
 
+template <typename T>
+std::string sql_str(bool bulk, const profiled<T>& v) {
+    return v.compact ? sql_str(bulk, compact_of(v.value)) : sql_str(bulk, v.value);
+}
+
 template <typename T>
 inline constexpr bool is_vector_v = false;
 
@@ -284,7 +334,7 @@ template <>
 inline std::string bin_to_sql<abieos::bytes>(pqxx::connection&, bool bulk, eosio::input_stream& bin) {
     uint32_t size;
     eosio::varuint32_from_bin(size, bin);
-    eosio::check(size > bin.end - bin.pos, "invalid bytes size");
+    eosio::check(size <= bin.end - bin.pos, "invalid bytes size");
     std::string result;
     abieos::hex(bin.pos, bin.pos + size, back_inserter(result));
     bin.pos += size;
@@ -304,6 +354,17 @@ inline std::string empty_to_sql<abieos::bytes>(pqxx::connection&, bool bulk) {
     return quote_bytea(bulk, "");
 }
 
+// The compact types are read and written as the types they wrap
+template <>
+inline std::string native_to_sql<compact_checksum256>(pqxx::connection&, bool bulk, const void* p) {
+    return sql_str(bulk, compact_of(*reinterpret_cast<const eosio::checksum256*>(p)));
+}
+
+template <>
+inline std::string native_to_sql<compact_name>(pqxx::connection&, bool bulk, const void* p) {
+    return sql_str(bulk, compact_of(*reinterpret_cast<const eosio::name*>(p)));
+}
+
 template <>
 inline std::string bin_to_sql<eosio::input_stream>(pqxx::connection&, bool, eosio::input_stream& /*bin*/) {
     eosio::check(false, "bin_to_sql: input_buffer unsupported");
@@ -323,6 +384,304 @@ inline std::string empty_to_sql<eosio::input_stream>(pqxx::connection&, bool bul
     return quote_bytea(bulk, "");
 }
 
+// PostgreSQL binary COPY format (COPY ... FROM STDIN (FORMAT binary)). A row is an int16 field count followed by the
+// fields; each field is an int32 length (-1 for null) followed by the type's binary send/recv representation. Integers
+// are big-endian. Composite values nest (oid, length, data) triples; arrays carry a small header and the element oid.
+
+inline const std::string copy_header{"PGCOPY\n\377\r\n\0\0\0\0\0\0\0\0\0", 19};
+inline const std::string copy_trailer{"\377\377", 2};
+
+inline constexpr uint32_t copy_null_length       = 0xffff'ffff;
+inline constexpr int64_t  copy_epoch_microseconds = 946'684'800'000'000; // 2000-01-01 relative to 1970-01-01
+
+inline void copy_uint16(std::string& dest, uint16_t v) {
+    char b[2] = {char(v >> 8), char(v)};
+    dest.append(b, sizeof(b));
+}
+
+inline void copy_uint32(std::string& dest, uint32_t v) {
+    char b[4] = {char(v >> 24), char(v >> 16), char(v >> 8), char(v)};
+    dest.append(b, sizeof(b));
+}
+
+inline void copy_uint64(std::string& dest, uint64_t v) {
+    copy_uint32(dest, uint32_t(v >> 32));
+    copy_uint32(dest, uint32_t(v));
+}
+
+inline void copy_patch_uint32(std::string& dest, size_t pos, uint32_t v) {
+    dest[pos]     = char(v >> 24);
+    dest[pos + 1] = char(v >> 16);
+    dest[pos + 2] = char(v >> 8);
+    dest[pos + 3] = char(v);
+}
+
+inline uint32_t copy_read_uint32(const char* p) {
+    return (uint32_t(uint8_t(p[0])) << 24) | (uint32_t(uint8_t(p[1])) << 16) | (uint32_t(uint8_t(p[2])) << 8) | uint32_t(uint8_t(p[3]));
+}
+
+inline void copy_null(std::string& dest) { copy_uint32(dest, copy_null_length); }
+
+inline void copy_bytes(std::string& dest, const char* data, size_t size) {
+    copy_uint32(dest, size);
+    dest.append(data, size);
+}
+
+// Reserves a field length; copy_end_field() fills it in once the field's content is known
+inline size_t copy_begin_field(std::string& dest) {
+    auto pos = dest.size();
+    dest.append(4, 0);
+    return pos;
+}
+
+inline void copy_end_field(std::string& dest, size_t pos) { copy_patch_uint32(dest, pos, dest.size() - pos - 4); }
+
+// Starts a one-dimensional array field with n elements; close it with copy_end_field()
+inline size_t copy_begin_array(std::string& dest, uint32_t elem_oid, uint32_t n) {
+    auto pos = copy_begin_field(dest);
+    copy_uint32(dest, n ? 1 : 0);
+    copy_uint32(dest, 0);
+    copy_uint32(dest, elem_oid);
+    if (n) {
+        copy_uint32(dest, n);
+        copy_uint32(dest, 1);
+    }
+    return pos;
+}
+
+// Counts the fields in a sequence of encoded fields. Fields within a composite value are preceded by their oid.
+inline uint32_t copy_count_fields(std::string_view fields, bool with_oids = false) {
+    uint32_t num = 0;
+    size_t   pos = 0;
+    while (pos < fields.size()) {
+        if (with_oids)
+            pos += 4;
+        if (pos + 4 > fields.size())
+            throw std::runtime_error("copy_count_fields: truncated field");
+        auto len = copy_read_uint32(fields.data() + pos);
+        pos += 4;
+        if (len != copy_null_length)
+            pos += len;
+        ++num;
+    }
+    if (pos != fields.size())
+        throw std::runtime_error("copy_count_fields: truncated field");
+    return num;
+}
+
+inline bool is_copy_safe_text(std::string_view s) {
+    for (size_t i = 0; i < s.size();) {
+        auto ch = uint8_t(s[i]);
+        if (!ch)
+            return false;
+        size_t len = ch < 0x80 ? 1 : (ch >> 5) == 0x6 ? 2 : (ch >> 4) == 0xe ? 3 : (ch >> 3) == 0x1e ? 4 : 0;
+        if (!len || i + len > s.size())
+            return false;
+        for (size_t j = 1; j < len; ++j)
+            if ((uint8_t(s[i + j]) >> 6) != 0x2)
+                return false;
+        i += len;
+    }
+    return true;
+}
+
+inline void copy_text(std::string& dest, std::string_view s) { copy_bytes(dest, s.data(), s.size()); }
+
+inline void copy_timestamp(std::string& dest, int64_t unix_microseconds) {
+    copy_uint32(dest, 8);
+    copy_uint64(dest, uint64_t(unix_microseconds - copy_epoch_microseconds));
+}
+
+inline void copy_numeric(std::string& dest, bool negative, const uint16_t* digits, uint16_t ndigits, int16_t weight) {
+    while (ndigits && !digits[ndigits - 1])
+        --ndigits;
+    if (!ndigits) {
+        weight   = 0;
+        negative = false;
+    }
+    copy_uint32(dest, 8 + 2 * ndigits);
+    copy_uint16(dest, ndigits);
+    copy_uint16(dest, weight);
+    copy_uint16(dest, negative ? 0x4000 : 0);
+    copy_uint16(dest, 0);
+    for (uint16_t i = 0; i < ndigits; ++i)
+        copy_uint16(dest, digits[i]);
+}
+
+inline void copy_numeric(std::string& dest, uint64_t v) {
+    uint16_t digits[5];
+    uint16_t n = 0;
+    uint16_t reversed[5];
+    do {
+        reversed[n++] = v % 10000;
+        v /= 10000;
+    } while (v);
+    for (uint16_t i = 0; i < n; ++i)
+        digits[i] = reversed[n - 1 - i];
+    copy_numeric(dest, false, digits, n, n - 1);
+}
+
+// s is a decimal integer, optionally preceded by '-'
+inline void copy_numeric(std::string& dest, std::string_view s) {
+    bool negative = !s.empty() && s[0] == '-';
+    if (negative)
+        s.remove_prefix(1);
+    if (s.empty() || s.size() > 64)
+        throw std::runtime_error("copy_numeric: invalid value");
+    uint16_t digits[16];
+    uint16_t n   = 0;
+    size_t   pos = 0;
+    while (pos < s.size()) {
+        size_t   len = n ? 4 : (s.size() % 4 ? s.size() % 4 : 4);
+        uint16_t d   = 0;
+        for (size_t i = 0; i < len; ++i) {
+            if (s[pos + i] < '0' || s[pos + i] > '9')
+                throw std::runtime_error("copy_numeric: invalid value");
+            d = d * 10 + (s[pos + i] - '0');
+        }
+        digits[n++] = d;
+        pos += len;
+    }
+    uint16_t first = 0;
+    while (first < n - 1 && !digits[first])
+        ++first;
+    copy_numeric(dest, negative, digits + first, n - first, n - first - 1);
+}
+
+// clang-format off
+inline void sql_copy(std::string& dest, bool v)                                           { copy_uint32(dest, 1); dest += char(v); }
+inline void sql_copy(std::string& dest, uint8_t v)                                        { copy_uint32(dest, 2); copy_uint16(dest, v); }
+inline void sql_copy(std::string& dest, int8_t v)                                         { copy_uint32(dest, 2); copy_uint16(dest, int16_t(v)); }
+inline void sql_copy(std::string& dest, uint16_t v)                                       { copy_uint32(dest, 4); copy_uint32(dest, v); }
+inline void sql_copy(std::string& dest, int16_t v)                                        { copy_uint32(dest, 2); copy_uint16(dest, v); }
+inline void sql_copy(std::string& dest, uint32_t v)                                       { copy_uint32(dest, 8); copy_uint64(dest, v); }
+inline void sql_copy(std::string& dest, int32_t v)                                        { copy_uint32(dest, 4); copy_uint32(dest, v); }
+inline void sql_copy(std::string& dest, uint64_t v)                                       { copy_numeric(dest, v); }
+inline void sql_copy(std::string& dest, int64_t v)                                        { copy_uint32(dest, 8); copy_uint64(dest, v); }
+inline void sql_copy(std::string& dest, double v)                                         { uint64_t x; memcpy(&x, &v, sizeof(x)); copy_uint32(dest, 8); copy_uint64(dest, x); }
+inline void sql_copy(std::string& dest, eosio::varuint32 v)                               { sql_copy(dest, v.value); }
+inline void sql_copy(std::string& dest, eosio::varint32 v)                                { sql_copy(dest, v.value); }
+inline void sql_copy(std::string& dest, const abieos::int128& v)                          { copy_numeric(dest, sql_str(false, v)); }
+inline void sql_copy(std::string& dest, const abieos::uint128& v)                         { copy_numeric(dest, sql_str(false, v)); }
+inline void sql_copy(std::string& dest, const abieos::float128& v)                        { copy_bytes(dest, (const char*)v.value.data(), v.value.size()); }
+inline void sql_copy(std::string& dest, eosio::name v)                                    { copy_text(dest, v.value ? std::string(v) : std::string()); }
+inline void sql_copy(std::string& dest, eosio::time_point v)                              { if (v.elapsed.count()) copy_timestamp(dest, v.elapsed.count()); else copy_null(dest); }
+inline void sql_copy(std::string& dest, eosio::time_point_sec v)                          { if (v.utc_seconds) copy_timestamp(dest, int64_t(v.utc_seconds) * 1'000'000); else copy_null(dest); }
+inline void sql_copy(std::string& dest, abieos::block_timestamp v)                        { if (v.slot) sql_copy(dest, v.to_time_point()); else copy_null(dest); }
+inline void sql_copy(std::string& dest, const eosio::checksum256& v)                      { copy_text(dest, v.value == abieos::checksum256{}.value ? "" : abieos::hex(v.value.begin(), v.value.end())); }
+inline void sql_copy(std::string& dest, const eosio::public_key& v)                       { copy_text(dest, public_key_to_string(v)); }
+inline void sql_copy(std::string& dest, const eosio::signature& v)                        { copy_text(dest, signature_to_string(v)); }
+inline void sql_copy(std::string& dest, const eosio::bytes& v)                            { copy_bytes(dest, v.data.data(), v.data.size()); }
+inline void sql_copy(std::string& dest, const eosio::input_stream& v)                     { copy_bytes(dest, v.pos, v.end - v.pos); }
+inline void sql_copy(std::string& dest, eosio::ship_protocol::transaction_status v)       { copy_text(dest, to_string(v)); }
+inline void sql_copy(std::string& dest, eosio::symbol v)                                  { copy_text(dest, eosio::symbol_to_string(v.value)); }
+inline void sql_copy(std::string& dest, const compact_checksum256& v)                     { copy_bytes(dest, (const char*)v.value.value.data(), v.value.value == abieos::checksum256{}.value ? 0 : v.value.value.size()); }
+inline void sql_copy(std::string& dest, compact_name v)                                   { copy_uint32(dest, 8); copy_uint64(dest, uint64_t(name_to_compact(v.value))); }
+// clang-format on
+
+template <typename T>
+void sql_copy(std::string& dest, const profiled<T>& v) {
+    if (v.compact)
+        sql_copy(dest, compact_of(v.value));
+    else
+        sql_copy(dest, v.value);
+}
+
+inline void sql_copy(std::string& dest, const std::string& s) {
+    if (is_copy_safe_text(s))
+        copy_text(dest, s);
+    else
+        copy_text(dest, abieos::hex(s.begin(), s.end()));
+}
+
+// Formats a list of values as sql literals separated by sep(), or in bulk mode as binary COPY fields
+template <typename... Ts>
+std::string sql_values(bool bulk, const Ts&... vs) {
+    std::string result;
+    if (bulk) {
+        (sql_copy(result, vs), ...);
+    } else {
+        bool first = true;
+        ((result += (first ? "" : sep(bulk)) + sql_str(bulk, vs), first = false), ...);
+    }
+    return result;
+}
+
+template <typename T>
+T copy_read(eosio::input_stream& bin) {
+    T v;
+    if constexpr (
+        std::is_same_v<T, eosio::varuint32> || std::is_same_v<T, eosio::varint32> || std::is_same_v<T, eosio::public_key> ||
+        std::is_same_v<T, eosio::signature> || std::is_same_v<T, std::string>)
+        from_bin(v, bin);
+    else
+        bin.read_raw<T>(v);
+    return v;
+}
+
+template <typename T>
+void bin_to_copy(std::string& dest, eosio::input_stream& bin) {
+    if constexpr (is_optional_v<T>) {
+        bool has_value;
+        bin.read_raw<bool>(has_value);
+        if (has_value)
+            bin_to_copy<typename T::value_type>(dest, bin);
+        else if (std::is_arithmetic_v<typename T::value_type> || is_string_v<typename T::value_type>)
+            sql_copy(dest, typename T::value_type{});
+        else
+            copy_null(dest);
+    } else {
+        sql_copy(dest, copy_read<T>(bin));
+    }
+}
+
+template <typename T>
+void native_to_copy(std::string& dest, const void* p) {
+    if constexpr (is_optional_v<T>) {
+        auto& obj = *reinterpret_cast<const T*>(p);
+        if (obj)
+            sql_copy(dest, *obj);
+        else if (std::is_arithmetic_v<typename T::value_type> || is_string_v<typename T::value_type>)
+            sql_copy(dest, typename T::value_type{});
+        else
+            copy_null(dest);
+    } else {
+        sql_copy(dest, *reinterpret_cast<const T*>(p));
+    }
+}
+
+template <typename T>
+void empty_to_copy(std::string& dest) {
+    if constexpr (is_optional_v<T>)
+        empty_to_copy<typename T::value_type>(dest);
+    else
+        sql_copy(dest, T{});
+}
+
+template <>
+inline void bin_to_copy<abieos::bytes>(std::string& dest, eosio::input_stream& bin) {
+    uint32_t size;
+    eosio::varuint32_from_bin(size, bin);
+    eosio::check(size <= bin.end - bin.pos, "invalid bytes size");
+    copy_bytes(dest, bin.pos, size);
+    bin.pos += size;
+}
+
+template <>
+inline void native_to_copy<compact_checksum256>(std::string& dest, const void* p) {
+    sql_copy(dest, compact_of(*reinterpret_cast<const eosio::checksum256*>(p)));
+}
+
+template <>
+inline void native_to_copy<compact_name>(std::string& dest, const void* p) {
+    sql_copy(dest, compact_of(*reinterpret_cast<const eosio::name*>(p)));
+}
+
+template <>
+inline void bin_to_copy<eosio::input_stream>(std::string&, eosio::input_stream& /*bin*/) {
+    eosio::check(false, "bin_to_copy: input_buffer unsupported");
+}
+
 inline abieos::time_point sql_to_time_point(std::string s) {
     if (s.empty())
         return {};
@@ -378,6 +737,8 @@ template <> inline void sql_to_bin<abieos::bytes>              (std::vector<char
 template <> inline void sql_to_bin<std::string>                (std::vector<char>& bin, const pqxx::field& f) { eosio::convert_to_bin( std::string{f.c_str()}, bin); } // todo: unescape
 template <> inline void sql_to_bin<eosio::input_stream>        (std::vector<char>& bin, const pqxx::field& f) { throw std::runtime_error("sql_to_bin<input_stream> not implemented"); }
 template <> inline void sql_to_bin<abieos::symbol>             (std::vector<char>& bin, const pqxx::field& f) { uint64_t sym; eosio::check(eosio::string_to_symbol(sym, f.c_str(), f.c_str() + f.size() - 1), "sql_to_bin<symbol> failed to convert"); eosio::convert_to_bin(sym, bin); }
+template <> inline void sql_to_bin<compact_checksum256>        (std::vector<char>& bin, const pqxx::field& f) { eosio::convert_to_bin( sql_to_checksum256(f.c_str()), bin); }
+template <> inline void sql_to_bin<compact_name>               (std::vector<char>& bin, const pqxx::field& f) { eosio::convert_to_bin( compact_to_name(f.as<int64_t>()), bin); }
 // clang-format on
 
 struct type {
@@ -386,6 +747,10 @@ struct type {
     std::string (*native_to_sql)(pqxx::connection&, bool, const void*)        = nullptr;
     std::string (*empty_to_sql)(pqxx::connection&, bool)                      = nullptr;
     void (*sql_to_bin)(std::vector<char>& bin, const pqxx::field&)            = nullptr;
+    uint32_t oid                                                              = 0; // 0: not a builtin; look up by name
+    void (*bin_to_copy)(std::string&, eosio::input_stream&)                   = nullptr;
+    void (*native_to_copy)(std::string&, const void*)                         = nullptr;
+    void (*empty_to_copy)(std::string&)                                       = nullptr;
 };
 
 template <typename T>
@@ -402,45 +767,52 @@ template <typename T>
 inline constexpr unknown_type<T> type_for;
 
 template <typename T>
-constexpr type make_type_for(const char* name) {
-    return type{name, bin_to_sql<T>, native_to_sql<T>, empty_to_sql<T>, sql_to_bin<T>};
+constexpr type make_type_for(const char* name, uint32_t oid) {
+    return type{name, bin_to_sql<T>, native_to_sql<T>, empty_to_sql<T>, sql_to_bin<T>, oid, bin_to_copy<T>, native_to_copy<T>, empty_to_copy<T>};
 }
 
 // clang-format off
-template<> inline constexpr type type_for<bool>                     = make_type_for<bool>(                      "bool"                      );
-template<> inline constexpr type type_for<uint8_t>                  = make_type_for<uint8_t>(                   "smallint"                  );
-template<> inline constexpr type type_for<int8_t>                   = make_type_for<int8_t>(                    "smallint"                  );
-template<> inline constexpr type type_for<uint16_t>                 = make_type_for<uint16_t>(                  "integer"                   );
-template<> inline constexpr type type_for<int16_t>                  = make_type_for<int16_t>(                   "smallint"                  );
-template<> inline constexpr type type_for<uint32_t>                 = make_type_for<uint32_t>(                  "bigint"                    );
-template<> inline constexpr type type_for<int32_t>                  = make_type_for<int32_t>(                   "integer"                   );
-template<> inline constexpr type type_for<uint64_t>                 = make_type_for<uint64_t>(                  "decimal"                   );
-template<> inline constexpr type type_for<int64_t>                  = make_type_for<int64_t>(                   "bigint"                    );
-template<> inline constexpr type type_for<abieos::uint128>          = make_type_for<abieos::uint128>(           "decimal"                   );
-template<> inline constexpr type type_for<abieos::int128>           = make_type_for<abieos::int128>(            "decimal"                   );
-template<> inline constexpr type type_for<double>                   = make_type_for<double>(                    "float8"                    );
-template<> inline constexpr type type_for<abieos::float128>         = make_type_for<abieos::float128>(          "bytea"                     );
-template<> inline constexpr type type_for<abieos::varuint32>        = make_type_for<abieos::varuint32>(         "bigint"                    );
-template<> inline constexpr type type_for<abieos::varint32>         = make_type_for<abieos::varint32>(          "integer"                   );
-template<> inline constexpr type type_for<abieos::name>             = make_type_for<abieos::name>(              "varchar(13)"               );
-template<> inline constexpr type type_for<abieos::checksum256>      = make_type_for<abieos::checksum256>(       "varchar(64)"               );
-template<> inline constexpr type type_for<std::string>              = make_type_for<std::string>(               "varchar"                   );
-template<> inline constexpr type type_for<abieos::time_point>       = make_type_for<abieos::time_point>(        "timestamp"                 );
-template<> inline constexpr type type_for<abieos::time_point_sec>   = make_type_for<abieos::time_point_sec>(    "timestamp"                 );
-template<> inline constexpr type type_for<abieos::block_timestamp>  = make_type_for<abieos::block_timestamp>(   "timestamp"                 );
-template<> inline constexpr type type_for<abieos::public_key>       = make_type_for<abieos::public_key>(        "varchar"                   );
-template<> inline constexpr type type_for<abieos::signature>        = make_type_for<abieos::signature>(         "varchar"                   );
-template<> inline constexpr type type_for<abieos::bytes>            = make_type_for<abieos::bytes>(             "bytea"                     );
-template<> inline constexpr type type_for<eosio::input_stream>      = make_type_for<eosio::input_stream>(       "bytea"                     );
-template<> inline constexpr type type_for<abieos::symbol>           = make_type_for<abieos::symbol>(            "varchar(10)"               );
+template<> inline constexpr type type_for<bool>                     = make_type_for<bool>(                      "bool",                        16);
+template<> inline constexpr type type_for<uint8_t>                  = make_type_for<uint8_t>(                   "smallint",                    21);
+template<> inline constexpr type type_for<int8_t>                   = make_type_for<int8_t>(                    "smallint",                    21);
+template<> inline constexpr type type_for<uint16_t>                 = make_type_for<uint16_t>(                  "integer",                     23);
+template<> inline constexpr type type_for<int16_t>                  = make_type_for<int16_t>(                   "smallint",                    21);
+template<> inline constexpr type type_for<uint32_t>                 = make_type_for<uint32_t>(                  "bigint",                      20);
+template<> inline constexpr type type_for<int32_t>                  = make_type_for<int32_t>(                   "integer",                     23);
+template<> inline constexpr type type_for<uint64_t>                 = make_type_for<uint64_t>(                  "decimal",                   1700);
+template<> inline constexpr type type_for<int64_t>                  = make_type_for<int64_t>(                   "bigint",                      20);
+template<> inline constexpr type type_for<abieos::uint128>          = make_type_for<abieos::uint128>(           "decimal",                   1700);
+template<> inline constexpr type type_for<abieos::int128>           = make_type_for<abieos::int128>(            "decimal",                   1700);
+template<> inline constexpr type type_for<double>                   = make_type_for<double>(                    "float8",                     701);
+template<> inline constexpr type type_for<abieos::float128>         = make_type_for<abieos::float128>(          "bytea",                       17);
+template<> inline constexpr type type_for<abieos::varuint32>        = make_type_for<abieos::varuint32>(         "bigint",                      20);
+template<> inline constexpr type type_for<abieos::varint32>         = make_type_for<abieos::varint32>(          "integer",                     23);
+template<> inline constexpr type type_for<abieos::name>             = make_type_for<abieos::name>(              "varchar(13)",               1043);
+template<> inline constexpr type type_for<abieos::checksum256>      = make_type_for<abieos::checksum256>(       "varchar(64)",               1043);
+template<> inline constexpr type type_for<std::string>              = make_type_for<std::string>(               "varchar",                   1043);
+template<> inline constexpr type type_for<abieos::time_point>       = make_type_for<abieos::time_point>(        "timestamp",                 1114);
+template<> inline constexpr type type_for<abieos::time_point_sec>   = make_type_for<abieos::time_point_sec>(    "timestamp",                 1114);
+template<> inline constexpr type type_for<abieos::block_timestamp>  = make_type_for<abieos::block_timestamp>(   "timestamp",                 1114);
+template<> inline constexpr type type_for<abieos::public_key>       = make_type_for<abieos::public_key>(        "varchar",                   1043);
+template<> inline constexpr type type_for<abieos::signature>        = make_type_for<abieos::signature>(         "varchar",                   1043);
+template<> inline constexpr type type_for<abieos::bytes>            = make_type_for<abieos::bytes>(             "bytea",                       17);
+template<> inline constexpr type type_for<eosio::input_stream>      = make_type_for<eosio::input_stream>(       "bytea",                       17);
+template<> inline constexpr type type_for<abieos::symbol>           = make_type_for<abieos::symbol>(            "varchar(10)",               1043);
 template<> inline constexpr type type_for<eosio::ship_protocol::transaction_status>
-                                                                    = make_type_for<eosio::ship_protocol::transaction_status>("transaction_status_type");
+                                                                    = make_type_for<eosio::ship_protocol::transaction_status>("transaction_status_type", 0);
+template<> inline constexpr type type_for<compact_checksum256>      = make_type_for<compact_checksum256>(       "bytea",                       17);
+template<> inline constexpr type type_for<compact_name>             = make_type_for<compact_name>(              "bigint",                      20);
+
+// Types in the compact profile; the same as type_for except for checksum256 and name
+template<typename T> inline constexpr auto compact_type_for         = type_for<T>;
+template<> inline constexpr type compact_type_for<abieos::checksum256> = type_for<compact_checksum256>;
+template<> inline constexpr type compact_type_for<abieos::name>     = type_for<compact_name>;
 // clang-format on
 
 template <typename T>
 inline constexpr auto make_optional_type_for() {
     if constexpr (is_known_type(type_for<T>))
-        return make_type_for<std::optional<T>>(type_for<T>.name);
+        return make_type_for<std::optional<T>>(type_for<T>.name, type_for<T>.oid);
     else
         return unknown_type<std::optional<T>>{};
 }
@@ -479,8 +851,43 @@ inline const std::map<std::string_view, type> abi_type_to_sql_type = {
     {"symbol",                  type_for<abieos::symbol>},
 };
 
+inline const std::map<std::string_view, type> compact_abi_type_to_sql_type = [] {
+    auto result           = abi_type_to_sql_type;
+    result["name"]        = compact_type_for<abieos::name>;
+    result["checksum256"] = compact_type_for<abieos::checksum256>;
+    return result;
+}();
+
 // clang-format on
 
+inline const std::map<std::string_view, type>& abi_type_to_sql_type_for(bool compact) {
+    return compact ? compact_abi_type_to_sql_type : abi_type_to_sql_type;
+}
+
+// Whether fill-pg created schema with --fpg-compact. The profile is recorded in schema_profile.
+inline bool is_compact_schema(pqxx::work& t, const std::string& schema) {
+    auto table = t.quote_name(schema) + ".schema_profile";
+    if (t.exec("select to_regclass(" + t.quote(table) + ") is null")[0][0].as<bool>())
+        return false;
+    auto r = t.exec("select profile from " + table);
+    return !r.empty() && r[0][0].as<std::string>() == "compact";
+}
+
+// Columns whose content fill-pg --fpg-blob-store keeps once per sha256 in the blob table
+inline bool is_blob_column(std::string_view table, std::string_view column) {
+    return (table == "account" && column == "abi") || (table == "code" && column == "code") ||
+           ((table == "action_trace" || table == "action_trace_v1") && column == "act_data");
+}
+
+// A blob column holds the sha256 of its content when the value is exactly 32 bytes; content of that size always
+// moves to the blob table
+inline bool is_blob_ref(const pqxx::field& f) { return f.size() == 2 + 64 && f.c_str()[0] == '\\' && f.c_str()[1] == 'x'; }
+
+// Whether fill-pg created schema with --fpg-blob-store
+inline bool has_blob_store(pqxx::work& t, const std::string& schema) {
+    return !t.exec("select to_regclass(" + t.quote(t.quote_name(schema) + ".blob") + ") is null")[0][0].as<bool>();
+}
+
 struct defs {
     using type   = pg::type;
     using field  = query_config::field<defs>;
@@ -0,0 +1,130 @@
+// copyright defined in LICENSE.txt
+
+#pragma once
+#include <eosio/ship_protocol.hpp>
+
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <cstdio>
+#include <cstring>
+
+namespace state_history {
+
+// A recording of the messages a state-history connection received: an 8-byte magic, then one frame per message.
+// Each frame is a kind byte, a uint32 size, then the message as nodeos sent it.
+namespace recording {
+
+static constexpr char     magic[8]          = {'s', 'h', 'i', 'p', 'r', 'e', 'c', '1'};
+static constexpr uint8_t  abi_frame         = 0;
+static constexpr uint8_t  result_frame      = 1;
+static constexpr uint32_t frame_header_size = 1 + 4;
+
+// Appends frames to a recording. Reconnects and restarts keep appending to the same file, after truncating a frame
+// which an earlier run didn't finish.
+struct recorder {
+    std::string path;
+    FILE*       file = nullptr;
+
+    recorder(const std::string& path)
+        : path(path) {
+        bool empty = !boost::filesystem::exists(path) || !boost::filesystem::file_size(path);
+        if (!empty) {
+            auto end = complete_size(path);
+            if (end < boost::filesystem::file_size(path))
+                boost::filesystem::resize_file(path, end);
+        }
+        file = fopen(path.c_str(), "ab");
+        if (!file)
+            throw std::runtime_error("can't open " + path + ": " + strerror(errno));
+        setvbuf(file, nullptr, _IOFBF, 4 * 1024 * 1024);
+        if (empty)
+            write_raw(magic, sizeof(magic));
+    }
+
+    recorder(const recorder&) = delete;
+    ~recorder() { fclose(file); }
+
+    // The size of the recording's magic and complete frames
+    static uint64_t complete_size(const std::string& path) {
+        boost::iostreams::mapped_file_source file(path);
+        if (file.size() < sizeof(magic) || memcmp(file.data(), magic, sizeof(magic)))
+            throw std::runtime_error(path + " is not a state-history recording");
+        uint64_t pos = sizeof(magic);
+        while (pos + frame_header_size <= file.size()) {
+            uint32_t size;
+            memcpy(&size, file.data() + pos + 1, sizeof(size));
+            if (size > file.size() - pos - frame_header_size)
+                break;
+            pos += frame_header_size + size;
+        }
+        return pos;
+    }
+
+    void write(uint8_t kind, const char* data, uint32_t size) {
+        write_raw((const char*)&kind, sizeof(kind));
+        write_raw((const char*)&size, sizeof(size));
+        write_raw(data, size);
+    }
+
+    void write_raw(const char* data, size_t size) {
+        if (fwrite(data, 1, size, file) != size)
+            throw std::runtime_error("can't write " + path + ": " + strerror(errno));
+    }
+};
+
+struct frame {
+    uint8_t     kind      = 0;
+    const char* data      = nullptr;
+    uint32_t    size      = 0;
+    uint32_t    block_num = 0; // result frames which hold a block
+};
+
+// Memory maps a recording and indexes its frames
+struct reader {
+    boost::iostreams::mapped_file_source file;
+    std::optional<frame>                 abi;
+    std::optional<frame>                 status;
+    std::vector<frame>                   blocks;
+
+    reader(const std::string& path) {
+        file.open(path);
+        if (file.size() < sizeof(magic) || memcmp(file.data(), magic, sizeof(magic)))
+            throw std::runtime_error(path + " is not a state-history recording");
+        auto pos = file.data() + sizeof(magic);
+        auto end = file.data() + file.size();
+        while (pos + frame_header_size <= end) {
+            frame f;
+            f.kind = *pos;
+            memcpy(&f.size, pos + 1, sizeof(f.size));
+            f.data = pos + frame_header_size;
+            if (f.size > end - f.data)
+                break; // the recorder was interrupted mid-frame
+            pos = f.data + f.size;
+            if (f.kind == abi_frame) {
+                if (!abi)
+                    abi = f;
+            } else if (f.kind == result_frame) {
+                eosio::input_stream          bin{f.data, f.size};
+                eosio::ship_protocol::result result;
+                from_bin(result, bin);
+                std::visit(
+                    [&](auto& r) {
+                        if constexpr (std::is_same_v<std::decay_t<decltype(r)>, eosio::ship_protocol::get_status_result_v0>) {
+                            if (!status)
+                                status = f;
+                        } else if (r.this_block) {
+                            f.block_num = r.this_block->block_num;
+                            blocks.push_back(f);
+                        }
+                    },
+                    result);
+            }
+        }
+        if (!abi || !status)
+            throw std::runtime_error(path + " doesn't hold an abi and a status result");
+    }
+};
+
+} // namespace recording
+} // namespace state_history
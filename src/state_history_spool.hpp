@@ -0,0 +1,177 @@
+// copyright defined in LICENSE.txt
+
+#pragma once
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <vector>
+
+namespace state_history {
+
+// Size of new spool segments. A message larger than this gets a segment of its own.
+static constexpr size_t spool_segment_size = 64 * 1024 * 1024;
+
+// An append-only log of received block messages, spread over memory-mapped segment files in a directory. The
+// connection appends messages as fast as nodeos sends them and delivers them to the filler from a read cursor at
+// the filler's pace. Segments are deleted once the filler has read and committed every block in them; the rest
+// survive restarts.
+//
+// A segment is a sequence of frames: a uint32 size, a uint32 block number, then the message. Segments are created
+// zero-filled and the size is written last, so a zero size marks the end, including after a crash mid-frame.
+struct spool {
+    static constexpr size_t frame_header_size = 4 + 4;
+
+    struct segment {
+        uint64_t                      number    = 0;
+        boost::filesystem::path       path      = {};
+        boost::iostreams::mapped_file file      = {};
+        size_t                        end       = 0; // write position
+        uint32_t                      max_block = 0;
+    };
+
+    boost::filesystem::path              dir;
+    size_t                               segment_size = 0;
+    uint64_t                             max_bytes    = 0;
+    std::deque<std::unique_ptr<segment>> segments;
+    uint64_t                             bytes        = 0;
+    size_t                               read_segment = 0; // index into segments
+    size_t                               read_offset  = 0;
+
+    spool(const boost::filesystem::path& dir, size_t segment_size, uint64_t max_bytes)
+        : dir(dir)
+        , segment_size(segment_size)
+        , max_bytes(max_bytes) {
+        boost::filesystem::create_directories(dir);
+        std::vector<boost::filesystem::path> paths;
+        for (auto& entry : boost::filesystem::directory_iterator(dir))
+            if (entry.path().extension() == ".spool")
+                paths.push_back(entry.path());
+        std::sort(paths.begin(), paths.end());
+        for (auto& path : paths) {
+            auto seg    = std::make_unique<segment>();
+            seg->number = std::stoull(path.stem().string());
+            seg->path   = path;
+            seg->file.open(path.string(), boost::iostreams::mapped_file::readwrite);
+            for_each_frame(*seg, [&](size_t, const char*, uint32_t, uint32_t block_num) {
+                seg->max_block = std::max(seg->max_block, block_num);
+            });
+            bytes += seg->file.size();
+            segments.push_back(std::move(seg));
+        }
+    }
+
+    // Calls f(offset, data, size, block_num) for each frame, then sets seg.end
+    template <typename F>
+    static void for_each_frame(segment& seg, F f) {
+        size_t pos = 0;
+        while (pos + frame_header_size <= seg.file.size()) {
+            uint32_t size, block_num;
+            memcpy(&size, seg.file.const_data() + pos, sizeof(size));
+            memcpy(&block_num, seg.file.const_data() + pos + 4, sizeof(block_num));
+            if (!size || size > seg.file.size() - pos - frame_header_size)
+                break;
+            f(pos, seg.file.const_data() + pos + frame_header_size, size, block_num);
+            pos += frame_header_size + size;
+        }
+        seg.end = pos;
+    }
+
+    bool full() const { return bytes >= max_bytes; }
+
+    void append(uint32_t block_num, const char* data, uint32_t size) {
+        if (segments.empty() || segments.back()->end + frame_header_size + size > segments.back()->file.size()) {
+            auto seg    = std::make_unique<segment>();
+            seg->number = segments.empty() ? 0 : segments.back()->number + 1;
+            char name[32];
+            snprintf(name, sizeof(name), "%016llu.spool", (unsigned long long)seg->number);
+            seg->path = dir / name;
+            boost::iostreams::mapped_file_params params(seg->path.string());
+            params.flags         = boost::iostreams::mapped_file::readwrite;
+            params.new_file_size = std::max(segment_size, frame_header_size + size);
+            seg->file.open(params);
+            bytes += seg->file.size();
+            segments.push_back(std::move(seg));
+        }
+        auto& seg = *segments.back();
+        auto  pos = seg.file.data() + seg.end;
+        memcpy(pos + 4, &block_num, sizeof(block_num));
+        memcpy(pos + frame_header_size, data, size);
+        memcpy(pos, &size, sizeof(size));
+        seg.end += frame_header_size + size;
+        seg.max_block = std::max(seg.max_block, block_num);
+    }
+
+    // The frame at the read cursor, if any. next() moves past it.
+    bool peek(const char*& data, uint32_t& size) {
+        while (read_segment < segments.size()) {
+            auto& seg = *segments[read_segment];
+            if (read_offset < seg.end) {
+                memcpy(&size, seg.file.const_data() + read_offset, sizeof(size));
+                data = seg.file.const_data() + read_offset + frame_header_size;
+                return true;
+            }
+            if (read_segment + 1 == segments.size())
+                return false;
+            ++read_segment;
+            read_offset = 0;
+        }
+        return false;
+    }
+
+    void next() {
+        uint32_t size;
+        memcpy(&size, segments[read_segment]->file.const_data() + read_offset, sizeof(size));
+        read_offset += frame_header_size + size;
+    }
+
+    // Calls f(segment_index, offset, data, size, block_num) for each unread frame
+    template <typename F>
+    void for_each_unread(F f) {
+        for (size_t i = read_segment; i < segments.size(); ++i)
+            for_each_frame(*segments[i], [&](size_t offset, const char* data, uint32_t size, uint32_t block_num) {
+                if (i > read_segment || offset >= read_offset)
+                    f(i, offset, data, size, block_num);
+            });
+    }
+
+    void seek(size_t segment_index, size_t offset) {
+        read_segment = segment_index;
+        read_offset  = offset;
+    }
+
+    // Deletes the segments before the read cursor which hold no blocks after committed_block. When that leaves the
+    // spool full, the last segment goes too once it's read and committed; appending can't continue until it does,
+    // e.g. when the spool is a single segment or a message outgrew the limit.
+    void release(uint32_t committed_block) {
+        while (read_segment > 0 && segments.front()->max_block <= committed_block) {
+            remove_front();
+            --read_segment;
+        }
+        if (full() && segments.size() == 1 && read_offset == segments.front()->end &&
+            segments.front()->max_block <= committed_block) {
+            remove_front();
+            read_offset = 0;
+        }
+    }
+
+    void clear() {
+        while (!segments.empty())
+            remove_front();
+        read_segment = 0;
+        read_offset  = 0;
+    }
+
+    void remove_front() {
+        auto seg = std::move(segments.front());
+        segments.pop_front();
+        bytes -= seg->file.size();
+        seg->file.close();
+        boost::filesystem::remove(seg->path);
+    }
+}; // spool
+
+} // namespace state_history
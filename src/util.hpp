@@ -2,10 +2,10 @@
 
 #include <eosio/stream.hpp>
 
-#include <boost/iostreams/device/back_inserter.hpp>
-#include <boost/iostreams/filter/zlib.hpp>
-#include <boost/iostreams/filtering_stream.hpp>
+#include <algorithm>
+#include <climits>
 #include <fstream>
+#include <zlib.h>
 
 inline std::string read_string(const char* filename) {
     try {
@@ -21,12 +21,30 @@ inline std::string read_string(const char* filename) {
     }
 }
 
-inline std::vector<char> zlib_decompress(eosio::input_stream data) {
-    std::vector<char>                   out;
-    boost::iostreams::filtering_ostream decomp;
-    decomp.push(boost::iostreams::zlib_decompressor());
-    decomp.push(boost::iostreams::back_inserter(out));
-    boost::iostreams::write(decomp, data.pos, data.end - data.pos);
-    boost::iostreams::close(decomp);
-    return out;
+// Inflates data and appends it to out, a contiguous DynamicBuffer such as beast's flat_buffer. out keeps its capacity
+// between calls, so callers which reuse it (e.g. pooled buffers) don't reallocate for every payload.
+template <typename DynamicBuffer>
+void zlib_decompress(eosio::input_stream data, DynamicBuffer& out) {
+    z_stream strm{};
+    if (inflateInit(&strm) != Z_OK)
+        throw std::runtime_error("zlib_decompress: inflateInit failed");
+    size_t chunk = std::max(size_t(4096), 4 * size_t(data.end - data.pos));
+    int    ret   = Z_OK;
+    while (ret != Z_STREAM_END) {
+        auto space     = out.prepare(chunk);
+        strm.next_in   = (Bytef*)data.pos;
+        strm.avail_in  = std::min(size_t(data.end - data.pos), size_t(UINT_MAX));
+        strm.next_out  = (Bytef*)space.data();
+        strm.avail_out = std::min(space.size(), size_t(UINT_MAX));
+        ret            = inflate(&strm, Z_NO_FLUSH);
+        data.pos       = (const char*)strm.next_in;
+        out.commit((char*)strm.next_out - (char*)space.data());
+        if (ret != Z_OK && ret != Z_STREAM_END) {
+            inflateEnd(&strm);
+            throw std::runtime_error(std::string("zlib_decompress: ") + (strm.msg ? strm.msg : "truncated or invalid data"));
+        }
+        if (!strm.avail_out)
+            chunk *= 2;
+    }
+    inflateEnd(&strm);
 }
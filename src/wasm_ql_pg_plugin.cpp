@@ -14,12 +14,19 @@ static abstract_plugin& _wasm_ql_pg_plugin = app().register_plugin<wasm_ql_pg_pl
 struct pg_database_interface : database_interface, std::enable_shared_from_this<pg_database_interface> {
     std::string                       schema = {};
     std::unique_ptr<const pg::config> config = {};
+    bool                              blobs  = false;
 
     virtual ~pg_database_interface() {}
 
     virtual std::unique_ptr<query_session> create_query_session();
 };
 
+// Blob table rows (hash, data), and each hash's row. Hashes are hex.
+struct blob_rows {
+    pqxx::result                            rows    = {};
+    std::unordered_map<std::string, size_t> by_hash = {};
+};
+
 struct pg_query_session : query_session {
     virtual ~pg_query_session() {}
 
@@ -84,6 +91,7 @@ struct pg_query_session : query_session {
 
         pqxx::work        t(sql_connection);
         auto              exec_result = t.exec(query_str);
+        auto              blobs       = fetch_blobs(t, query, exec_result);
         std::vector<char> result;
         std::vector<char> row_bin;
         abieos::push_varuint32(result, exec_result.size());
@@ -92,6 +100,15 @@ struct pg_query_session : query_session {
             int i = 0;
             for (size_t field_index = 0; field_index < query.result_fields.size();) {
                 auto& field = query.result_fields[field_index++];
+                if (db_iface->blobs && field_index <= query.table_obj->fields.size() &&
+                    pg::is_blob_column(query.table, field.name) && pg::is_blob_ref(r[i])) {
+                    auto blob = blobs.by_hash.find(r[i].c_str() + 2);
+                    if (blob == blobs.by_hash.end())
+                        throw std::runtime_error("query_database: missing blob " + std::string(r[i].c_str() + 2));
+                    field.type_obj->sql_to_bin(row_bin, blobs.rows[blob->second][1]);
+                    ++i;
+                    continue;
+                }
                 field.type_obj->sql_to_bin(row_bin, r[i++]);
                 if (field.begin_optional && !r[i - 1].as<bool>()) {
                     while (field_index < query.result_fields.size()) {
@@ -112,6 +129,31 @@ struct pg_query_session : query_session {
             throw std::runtime_error("query_database: result is too big");
         return result;
     }
+
+    // Fetches the blobs exec_result refers to in a single query. Result columns line up with query.result_fields.
+    blob_rows fetch_blobs(pqxx::work& t, const pg::query& query, const pqxx::result& exec_result) {
+        blob_rows blobs;
+        if (!db_iface->blobs)
+            return blobs;
+        std::vector<size_t> columns;
+        for (size_t i = 0; i < query.result_fields.size() && i < query.table_obj->fields.size(); ++i)
+            if (pg::is_blob_column(query.table, query.result_fields[i].name))
+                columns.push_back(i);
+        for (const auto& r : exec_result)
+            for (auto i : columns)
+                if (pg::is_blob_ref(r[i]))
+                    blobs.by_hash.emplace(r[i].c_str() + 2, 0);
+        if (blobs.by_hash.empty())
+            return blobs;
+        std::string hashes;
+        for (auto& [hash, _] : blobs.by_hash)
+            hashes += (hashes.empty() ? "" : ", ") + pg::quote_bytea(false, hash);
+        blobs.rows = t.exec("select hash, data from \"" + db_iface->schema + "\".blob where hash = any(array[" + hashes + "]::bytea[])");
+        blobs.by_hash.clear();
+        for (size_t i = 0; i < blobs.rows.size(); ++i)
+            blobs.by_hash[blobs.rows[i][0].c_str() + 2] = i;
+        return blobs;
+    }
 }; // pg_query_session
 
 std::unique_ptr<query_session> pg_database_interface::create_query_session() {
@@ -142,7 +184,18 @@ void wasm_ql_pg_plugin::plugin_initialize(const variables_map& options) {
         } catch (const std::exception& e) {
             throw std::runtime_error("error processing " + options["query-config"].as<std::string>() + ": " + e.what());
         }
-        config->prepare(state_history::pg::abi_type_to_sql_type);
+        bool compact = false;
+        {
+            pqxx::connection sql_connection;
+            pqxx::work       t(sql_connection);
+            compact               = pg::is_compact_schema(t, my->interface->schema);
+            my->interface->blobs  = pg::has_blob_store(t, my->interface->schema);
+        }
+        if (compact)
+            ilog("schema ${s} uses the compact profile", ("s", my->interface->schema));
+        if (my->interface->blobs)
+            ilog("schema ${s} has a blob store", ("s", my->interface->schema));
+        config->prepare(pg::abi_type_to_sql_type_for(compact));
         my->interface->config = std::move(config);
         app().find_plugin<wasm_ql_plugin>()->set_database(my->interface);
     }